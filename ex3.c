@@ -1,5 +1,25 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ex3.h"
 
+/* Default board; --rows, --cols and --connect pick another size at runtime */
 #ifndef ROWS
 #define ROWS 6
 #endif
@@ -8,7 +28,9 @@
 #define COLS 7
 #endif
 
+#ifndef CONNECT_N
 #define CONNECT_N 4
+#endif
 
 /* Tokens */
 #define EMPTY '.'
@@ -18,61 +40,1250 @@
 #define HUMAN 1
 #define COMPUTER 2
 
+/* Computer player modes */
+#define AI_RULE 1
+#define AI_SEARCH 2
+#define AI_MAX 3     //perfect play from the solver, the search when it runs out of time
+#define AI_MCTS 4    //Monte Carlo tree search with rule guided playouts, for big boards
+
+/* Board output of an interactive game, --render */
+#define RENDER_FULL 0     //the whole board after every move
+#define RENDER_COMPACT 1  //the whole board without the cell borders
+#define RENDER_DIFF 2     //only the cell of the last move
+#define RENDER_QUIET 3    //no boards and no computer moves, only the result
+#define OUTPUT_BUFFER 4096
+
+/* Search leaf evaluations */
+#define EVAL_CENTER 1   //tokens weighted by their distance to the center column
+#define EVAL_THREATS 2  //EVAL_CENTER plus open windows and threats by row parity
+
+/* Threat evaluation weights: an open window holding k tokens of one player scores k * k */
+#define THREAT_SCORE 32  //an open window one token short of a sequence
+#define PARITY_BONUS 16  //extra for a threat on its owner's row parity
+
+/* Search scores: a win found at ply p scores WIN_SCORE - p, so quicker wins rank higher */
+#define WIN_SCORE 30000
+#define DECISIVE_SCORE (WIN_SCORE / 2)
+#define INF_SCORE 32000
+#define DEFAULT_SEARCH_DEPTH 10
+#define DEFAULT_TT_MB 16
+#define MAX_SEARCH_THREADS 64
+#define DEFAULT_SOLVE_MS 5000  //solver budget of --ai=max per move when --time-ms is not given
+
+/* Monte Carlo tree search */
+#define DEFAULT_MCTS_MS 1000   //budget of --ai=mcts per move when neither --time-ms nor --nodes is given
+#define MCTS_EXPLORATION 0.5   //weight of sqrt(parent visits) / (1 + visits) against the mean result
+#define MCTS_EXPAND_VISITS 2   //playouts through a leaf before it gets children
+#define MCTS_CHUNK 64          //playouts between looks at the clock and the budget
+#define MCTS_EXPANDING 0xFFFFFFFFu  //MctsNode.children while one thread creates them
+#define MCTS_LEAF 0xFFFFFFFEu       //MctsNode.children of a node that ends the game
+#define MCTS_NONE 0xFFFFFFFFu       //no node
+#define MCTS_OPEN 0
+#define MCTS_WIN 1     //the player who moved into the node has won, or the opponent has only losing moves
+#define MCTS_LOSS 2    //the player to move wins on the spot
+#define MCTS_DRAW 3    //the board is full
+
+/* Transposition table bounds */
+#define BOUND_EXACT 1
+#define BOUND_LOWER 2  //the real score is at least the stored one (beta cutoff)
+#define BOUND_UPPER 3  //the real score is at most the stored one (failed low)
+#define TT_BUCKET_SIZE 4
+#define TT_GENERATION_SHIFT 40   //entry data bits above score, depth, bound and move
+#define TT_GENERATIONS (1 << 24) //ttClear wipes the memory once in this many calls
+
+/* Zobrist keys: the splitmix64 finalizer (mix64) of every (player, cell) pair, expanded by
+   the preprocessor so that zobristKeys is a read-only constant shared by every thread */
+#define ZOBRIST_MIX1(z) (((z) ^ ((z) >> 30)) * 0xBF58476D1CE4E5B9ULL)
+#define ZOBRIST_MIX2(z) (((z) ^ ((z) >> 27)) * 0x94D049BB133111EBULL)
+#define ZOBRIST_MIX3(z) ((z) ^ ((z) >> 31))
+#define ZOBRIST_KEY(player, index) \
+    ZOBRIST_MIX3(ZOBRIST_MIX2(ZOBRIST_MIX1(0x9E3779B97F4A7C15ULL * (uint64_t)((player) * 128 + (index) + 1))))
+#define ZOBRIST_KEYS4(player, index) ZOBRIST_KEY(player, index), ZOBRIST_KEY(player, (index) + 1), \
+    ZOBRIST_KEY(player, (index) + 2), ZOBRIST_KEY(player, (index) + 3)
+#define ZOBRIST_KEYS16(player, index) ZOBRIST_KEYS4(player, index), ZOBRIST_KEYS4(player, (index) + 4), \
+    ZOBRIST_KEYS4(player, (index) + 8), ZOBRIST_KEYS4(player, (index) + 12)
+#define ZOBRIST_KEYS64(player, index) ZOBRIST_KEYS16(player, index), ZOBRIST_KEYS16(player, (index) + 16), \
+    ZOBRIST_KEYS16(player, (index) + 32), ZOBRIST_KEYS16(player, (index) + 48)
+
+/* Batch self-play */
+#define DEFAULT_RANDOM_PLIES 4
+#define BATCH_CHUNK 16  //games a worker claims at a time
+
+/* Opening book */
+#define BOOK_MAGIC "C4BOOK1"  //with its terminating zero, fills BookHeader.magic
+#define DEFAULT_BOOK_PLIES 6
+
+/* Endgame database */
+#define ENDGAME_MAGIC "C4ENDG1"  //with its terminating zero, fills EndgameHeader.magic
+#define DEFAULT_ENDGAME_CELLS 8
+#define MAX_ENDGAME_CELLS 16
+#define DEFAULT_ENDGAME_GAMES 1000  //self-play games whose late positions seed the database
+#define ENDGAME_BUCKET_KEYS 4       //keys per displacement of the perfect hash, on average
+#define ENDGAME_STEP 0x9E3779B97F4A7C15ULL
+
+/* Game records */
+#define GAMES_MAGIC "C4GAMES"  //with its terminating zero, fills GameFileHeader.magic
+#define ANALYSIS_QUEUE 256     //games read ahead of the analysis workers
+
+/* Game server */
+#define SERVER_MAX_CLIENTS 256
+#define SERVER_LINE 256           //longest command line
+#define SERVER_INPUT 4096         //received bytes waiting to be run, per client
+#define SERVER_OUTPUT 65536       //unsent bytes per client
+#define SERVER_HIGH_WATER (SERVER_OUTPUT / 2) //above it a client's commands and moves wait
+#define GAME_POOL_CHUNK 4096      //game slots added each time the pool runs out
+#define GAME_INDEX_BITS 20        //a game id is its slot index and, above these bits, the slot's reuse count
+#define SERVER_MAX_GAMES (1 << GAME_INDEX_BITS)
+
+/* Consistency fuzzer */
+#define FUZZ_CHUNK 64  //games a fuzz worker claims at a time
+
+/* Tournament */
+#define MAX_PLAYERS 16
+
+/* Benchmarks */
+#define DEFAULT_PERFT_DEPTH 8
+#define DEFAULT_BENCH_GAMES 20
+#define BENCH_POSITIONS 256
+#define BENCH_MIN_NANOS 100000000LL  //every microbenchmark repeats its pass for at least 0.1 s
+#define LATENCY_BUCKETS 64           //one per power of two nanoseconds
+
+/* Bitboard layout: every column owns rows + 1 consecutive bits, bottom row first,
+   topped by an always-empty sentinel bit so that no run can wrap into the next column. */
+#if defined(__SIZEOF_INT128__)
+__extension__ typedef unsigned __int128 Bitboard;
+#define BITBOARD_BITS 128
+#else
+typedef uint64_t Bitboard;
+#define BITBOARD_BITS 64
+#endif
+
+/* Runtime board limits: besides these, (rows + 1) * cols bits must fit in a Bitboard */
+#define MAX_ROWS 16
+#define MAX_COLS 16
+#define MAX_CELLS BITBOARD_BITS
+
+#if ROWS > MAX_ROWS || COLS > MAX_COLS || (ROWS + 1) * COLS > BITBOARD_BITS
+#error "the default ROWS x COLS board does not fit in a bitboard"
+#endif
+
+/* Board geometries: the common sizes get win checks specialized at compile time */
+#define GEOMETRY_NARROW 0  //any size that fits in 64 bits
+#define GEOMETRY_WIDE 1    //any size that needs the full Bitboard
+#define GEOMETRY_6X7_4 2
+#define GEOMETRY_7X8_4 3
+#define GEOMETRY_9X10_5 4
+
+#define HOT_INLINE static inline __attribute__((always_inline))
+
+/* Batched rule moves: one word per board, BOARD_LANES boards per vector operation.
+   GCC vector extensions lower it to whatever the target has: four lanes in one 256-bit
+   register with -mavx2, two in one 128-bit register with the baseline SSE2. */
+#ifdef __AVX2__
+#define BOARD_LANES 4
+#else
+#define BOARD_LANES 2
+#endif
+typedef uint64_t LaneVector __attribute__((vector_size(BOARD_LANES * sizeof(uint64_t))));
+
+typedef struct {
+    Bitboard tokens[2];  //one mask per player: [0] = TOKEN_P1, [1] = TOKEN_P2
+    Bitboard occupied;   //tokens[0] | tokens[1]
+    int heights[MAX_COLS]; //number of tokens in each column
+    int16_t mirrorShift[MAX_COLS]; //bit index of a cell's mirror image minus its own, per column
+    int rows;
+    int cols;
+    int connectN;        //tokens in a row needed to win
+    int geometry;        //GEOMETRY_* fast path for this size
+    int moveCount;       //tokens on the board, full at rows * cols
+    uint64_t hash;       //Zobrist key of the tokens, updated on every play and undo
+    uint64_t mirrorHash; //Zobrist key of the left-right mirror, equal to hash when symmetric
+} Position;
+
+typedef struct {
+    uint64_t key;
+    int16_t score;
+    int8_t depth;
+    uint8_t bound;       //0 for an unused entry
+    int8_t move;
+} TranspositionEntry;
+
+/* A stored entry: data packs score, depth, bound, move and the table generation it was
+   stored in, check is key ^ data. Search threads share the table without locks; a slot
+   caught halfway through a write by another thread fails the check and simply reads as a miss. */
+typedef struct {
+    _Atomic uint64_t check;
+    _Atomic uint64_t data;  //0 for an unused slot
+} TranspositionSlot;
+
+/* One cache line per bucket: slots 0 and 1 keep the deepest results,
+   slots 2 and 3 always take the newest one */
+typedef struct {
+    _Alignas(64) TranspositionSlot slots[TT_BUCKET_SIZE];
+} TranspositionBucket;
+
+typedef struct {
+    TranspositionBucket *buckets;  //NULL when the table is disabled
+    uint64_t bucketMask;           //bucket count - 1, the count is a power of two
+    uint64_t generation;           //entries of any other generation read as unused slots
+} TranspositionTable;
+
+typedef struct {
+    int aiMode;            //AI_RULE, AI_SEARCH, AI_MAX or AI_MCTS
+    int maxDepth;          //deepest iteration of the iterative deepening
+    long long timeLimitMs; //per-move wall clock budget, 0 for none
+    long long nodeLimit;   //per-move node budget, 0 for none
+    long long ttSizeMb;    //transposition table size, 0 disables it; the tree of AI_MCTS
+    int searchThreads;     //threads searching every move together, 1 searches alone
+    int evaluation;        //EVAL_CENTER or EVAL_THREATS, the score of the search leaves
+    const char *bookPath;  //opening book to play from, NULL for none
+    const struct OpeningBook *book; //the mapped bookPath, opened by main
+    const char *endgamePath; //endgame database to play from, NULL for none
+    const struct EndgameTable *endgame; //the mapped endgamePath, opened by main
+    int showStats;         //print the hot path counters after a game or a batch
+    int ponder;            //search on a human opponent's time, see startPonder
+    int renderMode;        //RENDER_FULL, RENDER_COMPACT, RENDER_DIFF or RENDER_QUIET
+} EngineOptions;
+
+typedef struct {
+    int mode;              //RENDER_*
+    int fd;                //receives the buffered text with one write per flush
+    size_t length;
+    char text[OUTPUT_BUFFER];
+} GameOutput;
+
+typedef struct {
+    EngineOptions options;
+    int connectN;
+    int order[MAX_COLS];   //setIndexMap center-first move ordering
+    TranspositionTable tt;
+    long long nodes;
+    long long deadline;    //monotonic nanoseconds, 0 for none
+    int stopped;           //set once a budget runs out, unwinds the whole search
+    atomic_int *stopSignal; //raised by the main thread of a parallel search, NULL otherwise
+    int readyMove;         //found by pondering for the position to move in, -1 for none
+    struct MctsTree *mcts; //the tree of AI_MCTS, kept from move to move, NULL otherwise
+} SearchContext;
+
+/* A helper thread of a parallel search: it repeats the main thread's iterations on
+   its own copy of the position and shares nothing but the table and the stop signal */
+typedef struct {
+    Position pos;
+    SearchContext ctx;     //copy of the main context, the table buckets are not its own
+    int player;
+    int firstDepth;        //odd helpers run one iteration ahead to spread the work
+    pthread_t thread;
+} SearchHelper;
+
+typedef struct {
+    int move;
+    int score;
+    int depth;             //deepest fully completed iteration
+    long long nodes;
+} SearchResult;
+
+/* A node of the Monte Carlo tree. The children of a node sit next to each other in the
+   arena; they are created by the one thread that switches children from 0 to
+   MCTS_EXPANDING and published with a release store of the first child's index. */
+typedef struct {
+    atomic_int visits;     //playouts through the node, those still running included
+    atomic_int score;      //finished playouts in half points for the player who moved into the node
+    atomic_uint children;  //index of the first child, 0 for none yet, MCTS_EXPANDING or MCTS_LEAF
+    int8_t move;           //the column played into the node
+    int8_t childCount;
+    int8_t terminal;       //MCTS_OPEN, MCTS_WIN, MCTS_LOSS or MCTS_DRAW, set with MCTS_LEAF
+} MctsNode;
+
+typedef struct MctsTree {
+    MctsNode *nodes;       //the arena, the root is nodes[0]
+    MctsNode *spare;       //the other arena, the subtree kept for the next move is copied into it
+    uint32_t capacity;     //nodes in each arena
+    atomic_uint used;
+    atomic_llong playouts; //of the current move, for the node budget
+    Position root;
+    int rootPlayer;
+    int valid;             //root holds a position searched before
+} MctsTree;
+
+/* A thread running playouts on the shared tree */
+typedef struct {
+    MctsTree *tree;
+    const SearchContext *ctx;
+    uint64_t rngState;
+    long long playouts;
+    int depth;             //longest path into the tree
+    pthread_t thread;
+} MctsWorker;
+
+/* Search on the opponent's time: while a human thinks, a thread searches the position
+   after the reply it predicts, filling the computer's table. When the prediction comes
+   true and the search finished, its move is played without searching again. */
+typedef struct {
+    Position pos;          //the position after the predicted reply, before it for AI_MCTS
+    SearchContext ctx;     //copy of the computer's context, sharing its table or tree
+    int player;            //the computer, the human for AI_MCTS
+    int reply;             //the predicted move of the human
+    atomic_int stop;
+    SearchResult result;
+    int complete;          //the search ended by itself, result is its final answer
+    pthread_t thread;
+} Ponder;
+
+typedef struct {
+    int rows;
+    int cols;
+    int connectN;
+} BoardOptions;
+
+typedef struct {
+    long long games;       //number of games to play, 0 for an interactive game
+    int threads;           //worker threads, 0 for one per online core
+    uint64_t seed;
+    int randomPlies;       //random opening moves that make the games differ
+    const char *recordPath; //binary game file to write the games to, NULL for none
+} BatchOptions;
+
+typedef struct {
+    int8_t moves[MAX_CELLS];
+    int length;
+    int winner;            //0 for a draw, otherwise the player number
+} GameRecord;
+
+/* Binary game file: this header, then one record per game: its length, its winner and
+   the moves two to a byte, the first in the low nibble. Records are appended as games
+   finish and read front to back, so a file never has to fit in memory. */
+typedef struct {
+    char magic[8];
+    uint8_t rows;
+    uint8_t cols;
+    uint8_t connectN;
+    uint8_t unused[5];
+} GameFileHeader;
+
+/* Reads games from a binary game file or a text file with one game per line: a move
+   string such as 4453, or a batch output line whose last field is the move string */
+typedef struct {
+    FILE *file;
+    int binary;
+    BoardOptions board;    //from the header of a binary file, the command line otherwise
+} GameReader;
+
+/* Bounded queue between the thread reading a game file and the analysis workers */
+typedef struct {
+    GameRecord records[ANALYSIS_QUEUE];
+    long long indices[ANALYSIS_QUEUE];  //game number of every queued record
+    int head;
+    int count;
+    int done;              //set by the reader at the end of the file
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    pthread_mutex_t outputLock;  //one output line at a time, the totals below
+    long long positions;
+    long long agreements;  //positions where the played move is the engine's move
+    const EngineOptions *engine;
+    const BoardOptions *board;
+} AnalysisQueue;
+
+typedef struct {
+    const EngineOptions *engine;
+    const BatchOptions *batch;
+    const BoardOptions *board;
+    atomic_llong nextGame;
+    //a finished chunk waits in a window slot until every earlier chunk is out, so the games
+    //come out in order with any thread count and the memory does not grow with their number
+    GameRecord *window;    //windowChunks slots of BATCH_CHUNK records
+    int *windowReady;      //games waiting in each slot, 0 for a free slot
+    long long windowChunks;
+    long long nextChunk;   //the first chunk not written yet
+    pthread_mutex_t lock;  //guards the window and everything below
+    pthread_cond_t slotFree;
+    FILE *recordFile;      //--record, NULL for none
+    int recorded;          //0 once a record could not be written, nothing more is written then
+    long long wins[3];     //draws, player 1 and player 2 wins
+} BatchJob;
+
+/* Opening book file: the header, then count canonical keys in increasing order, then
+   count uint32_t entries in the same order (score: bits 0-15, move: 16-23, depth: 24-31).
+   Moves are stored for the canonical side of the mirror. All fields in native byte order. */
+typedef struct {
+    char magic[8];
+    int32_t rows;
+    int32_t cols;
+    int32_t connectN;
+    int32_t plies;         //the book holds every position with at most plies tokens
+    uint64_t count;
+} BookHeader;
+
+typedef struct OpeningBook {
+    void *map;             //the whole file, mapped read only and shared
+    size_t size;
+    const BookHeader *header;
+    const uint64_t *keys;
+    const uint32_t *entries;
+} OpeningBook;
+
+typedef struct {
+    int enabled;
+    int perftDepth;        //perft runs depth 1 up to this
+    int games;             //self-play games timed for the move latency histogram
+} BenchOptions;
+
+/* Random unfinished positions, kept both as char boards and bitboards */
+typedef struct {
+    char boards[BENCH_POSITIONS][MAX_ROWS][MAX_COLS];
+    Position positions[BENCH_POSITIONS];
+    int lastPlayer[BENCH_POSITIONS];
+    int lastRow[BENCH_POSITIONS];  //board row of the last token, 0 at the top
+    int lastCol[BENCH_POSITIONS];
+    int indexMap[MAX_COLS];
+    int count;
+} BenchSet;
+
+/* One pass of a microbenchmark over the set, returns the operations done */
+typedef long long (*BenchFunction)(BenchSet *set, long long *sink);
+
+/* Differential fuzzing: random games on random boards, checking after every move that the
+   bitboard engine agrees with the char board functions it replaced */
+typedef struct {
+    const BatchOptions *batch;
+    long long games;
+    atomic_llong nextGame;
+    atomic_llong positions;
+    atomic_llong checks;
+    atomic_int failed;     //set by the first mismatch, stops every worker
+    pthread_mutex_t lock;  //guards report
+    char report[512];      //the first mismatch
+} FuzzJob;
+
+typedef struct {
+    long long games;       //games per pairing of players, 0 when not running a tournament
+    const char *openingsPath; //game file whose games are the openings, NULL for random ones
+    int playerCount;
+    const char *players[MAX_PLAYERS]; //--player specs: engine options without their dashes, comma separated
+} TournamentOptions;
+
+typedef struct {
+    GameRecord record;
+    int players[2];        //the tournament players playing player 1 and player 2
+    int moves[2];          //computer moves of each side, the opening not included
+    long long nanos[2];    //time of those moves
+    long long nodes[2];
+} TournamentGame;
+
+typedef struct {
+    const EngineOptions *players;  //one per tournament player
+    int playerCount;
+    const BatchOptions *batch;
+    const BoardOptions *board;
+    const GameRecord *openings;    //NULL for random openings
+    long long openingCount;
+    long long gamesPerPairing;     //even, every opening is played with both colors
+    long long totalGames;
+    atomic_llong nextGame;
+    //a finished game waits in a window slot until every earlier game is in, so --record gets
+    //the games in order and the memory does not grow with their number
+    TournamentGame *window;        //windowGames slots
+    int *windowReady;              //1 for a finished game waiting in the slot
+    long long windowGames;
+    long long nextIndex;           //the first game not taken in yet
+    pthread_mutex_t lock;          //guards the window and everything below
+    pthread_cond_t slotFree;
+    FILE *recordFile;              //--record, NULL for none
+    int recorded;                  //0 once a record could not be written, nothing more is written then
+    //results[a][b]: wins, draws and losses of player a against player b
+    long long results[MAX_PLAYERS][MAX_PLAYERS][3];
+    long long moves[MAX_PLAYERS], nanos[MAX_PLAYERS], nodes[MAX_PLAYERS];
+} TournamentJob;
+
+typedef struct {
+    const char *path;      //file to write, NULL when not making a book
+    int plies;
+} BookOptions;
+
+typedef struct {
+    Position pos;
+    uint64_t key;          //canonical key of pos
+    uint32_t entry;        //packed search result, filled in by the workers
+} BookRecord;
+
+typedef struct {
+    const EngineOptions *engine;
+    BookRecord *records;
+    long long count;
+    long long capacity;
+    long long *slots;      //open addressing set of record indices, -1 for free
+    uint64_t slotMask;
+    atomic_llong nextRecord;
+} BookJob;
+
+/* Endgame database file: the header, then buckets uint32_t displacements, then slots
+   canonical keys, then slots uint32_t entries (score: bits 0-15, move: 16-23), all in
+   native byte order. Scores are exact and relative to the position, like the table's.
+   A key belongs to bucket mix64(key) % buckets and sits in slot endgameSlot(key, d) for
+   the displacement d of its bucket; no two keys share a slot. Free slots hold key 0. */
+typedef struct {
+    char magic[8];
+    int32_t rows;
+    int32_t cols;
+    int32_t connectN;
+    int32_t cells;         //the database holds positions with at most cells empty cells
+    uint64_t count;
+    uint64_t buckets;      //even, so that the keys after the displacements stay aligned
+    uint64_t slots;
+} EndgameHeader;
+
+typedef struct EndgameTable {
+    void *map;             //the whole file, mapped read only and shared
+    size_t size;
+    const EndgameHeader *header;
+    const uint32_t *displacements;
+    const uint64_t *keys;
+    const uint32_t *entries;
+} EndgameTable;
+
+typedef struct {
+    const char *path;      //file to write, NULL when not making a database
+    int cells;
+} EndgameOptions;
+
+typedef struct {
+    uint64_t key;          //canonical key, 0 for a free memo slot
+    uint32_t entry;        //packed as in the file
+} EndgameRecord;
+
+/* The positions one enumeration worker has solved, an open addressing set at most half full */
+typedef struct {
+    EndgameRecord *slots;
+    uint64_t mask;
+    long long count;
+} EndgameMemo;
+
+typedef struct {
+    const EngineOptions *engine; //players of the seed games
+    const BatchOptions *batch;
+    const BoardOptions *board;
+    int cells;
+    long long games;
+    atomic_llong nextGame;
+    atomic_llong seeds;    //games that got down to cells empty cells
+    atomic_int failed;     //a worker ran out of memory
+} EndgameJob;
+
+typedef struct {
+    EndgameJob *job;
+    EndgameMemo memo;
+    pthread_t thread;
+} EndgameWorker;
+
+/* A game of the server. Slots live in fixed chunks that never move, so a worker can hold
+   a pointer to one while the event loop grows the pool. */
+typedef struct ServerGame {
+    Position pos;
+    uint32_t generation;   //times the slot has been reused, part of the game id
+    int index;             //slot number
+    int nextFree;          //next free slot while free, -1 at the end of the list
+    struct ServerGame *nextJob; //in the worker queue, then in the finished list
+    int client;            //owning connection, -1 while free
+    int types[2];          //HUMAN or COMPUTER for each player
+    int player;            //the player to move
+    int busy;              //a worker owns pos and is choosing the computer move
+    int ended;             //ended while busy, freed when the worker hands it back
+    int over;
+    int aiMove;            //the worker's move
+} ServerGame;
+
+typedef struct {
+    ServerGame **chunks;   //GAME_POOL_CHUNK slots each
+    int chunkCount;
+    int freeList;          //first free slot, -1 when the pool is full
+    int live;              //slots in use
+} GamePool;
+
+typedef struct {
+    int inFd;              //-1 for an unused client
+    int outFd;             //the same socket as inFd, or stdout for the stdin client
+    char input[SERVER_INPUT];
+    int inputLength;
+    int skipping;          //the line is too long, its rest is dropped
+    int inputClosed;
+    char output[SERVER_OUTPUT];
+    int outputLength;
+} ServerClient;
+
+/* The event loop owns the games and the clients; the workers only see the games that
+   the job list hands them, until they put them on the finished list */
+typedef struct {
+    GamePool pool;
+    ServerClient clients[SERVER_MAX_CLIENTS];
+    int listenFd;          //-1 when serving stdin
+    int wakeFds[2];        //a worker writes a byte when it finishes a game's move
+    pthread_mutex_t lock;  //guards the lists and stopping
+    pthread_cond_t jobReady;
+    ServerGame *jobHead;
+    ServerGame *jobTail;
+    ServerGame *finished;
+    ServerGame *parked;    //finished games whose client is behind on output, event loop only
+    int stopping;
+    int busyGames;         //games out at the workers, event loop only
+    int shutdown;          //a client asked the server to stop
+    const EngineOptions *engine;
+    const BoardOptions *board;
+} GameServer;
+
+/* Counters of the hot paths. Every thread counts into its own copy, so counting is a plain
+   increment without atomics or shared cache lines; a thread adds its copy to the process
+   totals with countersFlush when it is done. */
+typedef struct {
+    long long tokenInserts;   //insertToken calls
+    long long tokenUninserts; //uninsertToken calls
+    long long positionPlays;
+    long long positionUndos;
+    long long winChecks;      //sequence checks on the char board or a position, winning-cell maps
+    long long nodes;          //search and solver nodes
+    long long ttHits;
+    long long ttMisses;
+    long long cutoffs;        //beta cutoffs and cutoffs by a table bound
+    long long computerMoves;
+    long long moveNanos;      //wall clock of all computer moves
+    long long maxMoveNanos;   //of the slowest computer move
+    long long ponderHits;     //human moves that were the predicted reply
+    long long ponderMisses;
+} EngineCounters;
+
+_Thread_local EngineCounters threadCounters;
+EngineCounters mergedCounters;  //flushed threads, under countersLock
+pthread_mutex_t countersLock = PTHREAD_MUTEX_INITIALIZER;
+
+const uint64_t zobristKeys[2][BITBOARD_BITS] = {
+#if BITBOARD_BITS == 128
+    {ZOBRIST_KEYS64(0, 0), ZOBRIST_KEYS64(0, 64)},
+    {ZOBRIST_KEYS64(1, 0), ZOBRIST_KEYS64(1, 64)},
+#else
+    {ZOBRIST_KEYS64(0, 0)},
+    {ZOBRIST_KEYS64(1, 0)},
+#endif
+};
+
+/* Library API engine, see ex3.h: one game with its own search state and counters */
+struct Ex3Engine {
+    Position pos;
+    char board[MAX_ROWS][MAX_COLS]; //kept in step with pos for ex3EngineRender
+    int8_t moves[MAX_CELLS];  //columns played, for ex3EngineUndo
+    int status;               //EX3_PLAYING, EX3_WIN_P1, EX3_WIN_P2 or EX3_DRAW
+    SearchContext ctx;        //options, move order and table
+    EngineCounters counters;  //swapped in for threadCounters while the engine searches
+    Ex3Write write;
+    void *user;
+};
+
+_Static_assert(EX3_AI_RULE == AI_RULE && EX3_AI_SEARCH == AI_SEARCH && EX3_AI_MAX == AI_MAX && EX3_AI_MCTS == AI_MCTS
+               && EX3_EVAL_CENTER == EVAL_CENTER && EX3_EVAL_THREATS == EVAL_THREATS,
+               "library constants must match the engine's");
+
+/* The char board functions below walk the grid on purpose: they are the reference that
+   --fuzz and --bench hold the bitboard engine against, so they must not share its code.
+   The board-taking computer player functions load a Position from the grid on every call;
+   anything that plays many moves keeps a Position and calls the position* functions. */
+
 /* Game Logic / State Check */
-int isColumnFull(char[][COLS], int, int, int);
-int isBoardFull(char[][COLS], int, int);
+int isColumnFull(char[][MAX_COLS], int, int, int);
+int isBoardFull(char[][MAX_COLS], int, int);
 int isInBounds(int, int, int, int);
-int getColumnHeight(char[][COLS], int, int);
-int checkIfPossibleToPutInAColumn(char board[][COLS], int rows, int cols, int col);
-int checkIfNumSequenceForPlayer(char playerToken, char board[][COLS], int rows, int cols, int inSequenceNum);
-int checkIfNumSequenceForPlayerBecauseOfLastMove(char playerToken, char board[][COLS], int rows, int cols, int inSequenceNum, int lastMoveRow, int lastMoveCol);
+int getColumnHeight(char[][MAX_COLS], int, int);
+int checkIfPossibleToPutInAColumn(char board[][MAX_COLS], int rows, int cols, int col);
+int checkIfNumSequenceForPlayer(char playerToken, char board[][MAX_COLS], int rows, int cols, int inSequenceNum);
+int checkIfNumSequenceForPlayerBecauseOfLastMove(char playerToken, char board[][MAX_COLS], int rows, int cols, int inSequenceNum, int lastMoveRow, int lastMoveCol);
 
 /* Player Input / Type */
 int getPlayerType(int);
-int requestHumanInput(char board[][COLS], int rows, int cols);
-int playPlayerQueary(char board[][COLS], int rows, int cols, int IndexChoiseArray[COLS], int numPlayer, int playerType);
+int requestHumanInput(char board[][MAX_COLS], int rows, int cols);
+int playPlayerQueary(char board[][MAX_COLS], int rows, int cols, int IndexChoiseArray[MAX_COLS], int numPlayer, int playerType);
 
 /* Board Management */
-void initBoard(char[][COLS], int, int);
-void printBoard(char[][COLS], int, int);
-int insertToken(char [][COLS], int, int, char, int);
-int uninsertToken(char [][COLS], int, int, int);
+void initBoard(char[][MAX_COLS], int, int);
+void printBoard(char[][MAX_COLS], int, int);
+void renderBoard(char board[][MAX_COLS], int rows, int cols, Ex3Write write, void *user);
+void writeFile(void *user, const char *text, size_t length);
+void renderCompactBoard(char board[][MAX_COLS], int rows, int cols, Ex3Write write, void *user);
+void renderMove(GameOutput *out, char board[][MAX_COLS], int rows, int cols, int col);
+void outputInit(GameOutput *out, int mode, int fd);
+void outputWrite(void *user, const char *text, size_t length);
+void outputPrintf(GameOutput *out, const char *format, ...);
+void outputFlush(GameOutput *out);
+void writeFully(int fd, const char *text, size_t length);
+int insertToken(char [][MAX_COLS], int, int, char, int);
+int uninsertToken(char [][MAX_COLS], int, int, int);
+
+/* Bitboard Engine */
+int playerIndex(char playerToken);
+void defaultBoardOptions(BoardOptions *board);
+int parseBoardOption(BoardOptions *board, const char *arg);
+int isValidBoardSize(int rows, int cols, int connectN);
+int geometryOf(int rows, int cols, int connectN);
+void positionInit(Position *pos, int rows, int cols, int connectN);
+void positionLoad(Position *pos, char board[][MAX_COLS], int rows, int cols, int connectN);
+int positionBitIndex(const Position *pos, int row, int col);
+Bitboard positionCellBit(const Position *pos, int row, int col);
+int positionCanPlay(const Position *pos, int col);
+int positionPlay(Position *pos, int player, int col);
+int positionUndo(Position *pos, int col);
+int positionIsFull(const Position *pos);
+int positionHasSequence(const Position *pos, int player, int sequenceNum);
+int positionMoveMakesSequence(const Position *pos, int player, int col, int sequenceNum);
+int positionCellInSequence(const Position *pos, int player, int row, int col, int sequenceNum);
+HOT_INLINE int cellInSequenceNarrow(uint64_t tokens, uint64_t cell, int rows, int sequenceNum);
+HOT_INLINE int cellInSequenceWide(Bitboard tokens, Bitboard cell, int rows, int sequenceNum);
+HOT_INLINE int positionIsNarrow(const Position *pos);
+Bitboard positionPlayableCells(const Position *pos);
+void positionWinningCells(const Position *pos, int sequenceNum, Bitboard cells[2]);
+HOT_INLINE void winningCellsNarrow(uint64_t tokens0, uint64_t tokens1, int rows, int cols, int sequenceNum, Bitboard cells[2]);
+HOT_INLINE void winningCellsWide(Bitboard tokens0, Bitboard tokens1, int rows, int cols, int sequenceNum, Bitboard cells[2]);
+
+/* Transposition Table */
+uint64_t zobristKey(int player, int bitIndex);
+uint64_t positionCanonicalKey(const Position *pos, int *mirrored);
+int positionIsSymmetric(const Position *pos);
+int ttInit(TranspositionTable *tt, long long sizeMb);
+void ttFree(TranspositionTable *tt);
+void ttClear(TranspositionTable *tt);
+uint64_t ttPack(int score, int depth, int bound, int move);
+void ttUnpack(uint64_t key, uint64_t data, TranspositionEntry *entry);
+int ttProbe(const TranspositionTable *tt, uint64_t key, TranspositionEntry *entry);
+void ttStore(TranspositionTable *tt, uint64_t key, int score, int depth, int bound, int move);
+int scoreToTable(int score, int ply);
+int scoreFromTable(int score, int ply);
 
 /* Computer AI */
-void setIndexMap(int array[COLS], int cols);
-int checkPlayerForPossibleSequence(char [][COLS], int, int, char, int, int[COLS]);
-int generateComputerPlayerMove(char [][COLS], int, int, char, char, int[COLS]);
+void setIndexMap(int array[MAX_COLS], int cols);
+int checkPlayerForPossibleSequence(char [][MAX_COLS], int, int, char, int, int[MAX_COLS]);
+int generateComputerPlayerMove(char [][MAX_COLS], int, int, char, char, int[MAX_COLS]);
+int findPositionSequenceMove(const Position *pos, int player, int sequenceNum, const int indexMap[MAX_COLS]);
+int firstColumnIn(const Position *pos, Bitboard cells, const int indexMap[MAX_COLS]);
+int generatePositionMove(const Position *pos, int player, int connectN, const int indexMap[MAX_COLS]);
+
+/* Search */
+void defaultEngineOptions(EngineOptions *options);
+int parseEngineOption(EngineOptions *options, const char *arg);
+void searchContextInit(SearchContext *ctx, const EngineOptions *options, int cols, int connectN);
+void searchContextFree(SearchContext *ctx);
+void searchContextReset(SearchContext *ctx);
+int orderMoves(const Position *pos, const SearchContext *ctx, int firstMove, int moves[MAX_COLS]);
+int generateMoves(const Position *pos, int player, const Bitboard wins[2], Bitboard playable, const int order[MAX_COLS], int moves[MAX_COLS]);
+HOT_INLINE int generateMovesNarrow(const Position *pos, uint64_t opponentWins, uint64_t playable, const int order[MAX_COLS], int moves[MAX_COLS]);
+HOT_INLINE int generateMovesWide(const Position *pos, Bitboard opponentWins, Bitboard playable, const int order[MAX_COLS], int moves[MAX_COLS]);
+void promoteMove(int moves[MAX_COLS], int count, int move);
+long long monotonicNanos(void);
+int bitboardCount(Bitboard b);
+int bitboardLowestIndex(Bitboard b);
+int centerWeight(int col, int cols);
+int threatWindowScore(Bitboard tokens0, Bitboard tokens1, Bitboard window, int rows, int connectN);
+HOT_INLINE int threatWindowScoreNarrow(uint64_t tokens0, uint64_t tokens1, uint64_t window, int rows, int connectN);
+int evaluatePosition(const Position *pos, int player, int evaluation);
+int moveScoreDelta(const Position *pos, int player, int col, int evaluation);
+HOT_INLINE int threatDeltaNarrow(const Position *pos, int player, int col);
+HOT_INLINE int threatDeltaWide(const Position *pos, int player, int col);
+int isWinningMove(const Position *pos, int player, int col, int connectN);
+int searchBudgetExceeded(SearchContext *ctx);
+int negamax(Position *pos, int player, int depth, int alpha, int beta, int ply, int score, SearchContext *ctx);
+int searchRoot(Position *pos, int player, int depth, int pvMove, SearchContext *ctx, int *bestMove);
+void *searchHelperWorker(void *arg);
+int startSearchHelpers(const Position *pos, int player, const SearchContext *ctx, atomic_int *stopSignal, SearchHelper helpers[]);
+long long stopSearchHelpers(SearchHelper helpers[], int count, atomic_int *stopSignal);
+SearchResult searchBestMove(Position *pos, int player, SearchContext *ctx);
+int computerPlayerMove(Position *pos, int player, SearchContext *ctx);
+int chooseComputerMove(Position *pos, int player, SearchContext *ctx);
+
+/* Solver */
+int orderSolverMoves(Position *pos, int player, int moves[MAX_COLS], int count, int connectN);
+int solveNegamax(Position *pos, int player, int alpha, int beta, int ply, SearchContext *ctx);
+int solvePosition(Position *pos, int player, int weak, SearchContext *ctx);
+SearchResult solveBestMove(Position *pos, int player, int weak, SearchContext *ctx);
+
+/* Monte Carlo Tree Search */
+MctsTree *mctsCreate(long long sizeMb);
+void mctsFree(MctsTree *tree);
+void mctsCopyNode(MctsNode *to, const MctsNode *from);
+uint32_t mctsFind(const MctsTree *tree, uint32_t index, const Position *at, int player, const Position *target, int plies);
+void mctsKeepSubtree(MctsTree *tree, uint32_t index);
+void mctsSetRoot(MctsTree *tree, const Position *pos, int player);
+uint32_t mctsExpand(MctsTree *tree, MctsNode *node, const Position *pos, int player, int connectN, const int order[MAX_COLS]);
+uint32_t mctsSelect(const MctsTree *tree, const MctsNode *node, uint32_t first);
+int mctsRollout(Position *pos, int player, int connectN, const int order[MAX_COLS], uint64_t *rngState);
+int mctsPlayout(MctsTree *tree, int connectN, const int order[MAX_COLS], uint64_t *rngState);
+int mctsBudgetExceeded(MctsTree *tree, const SearchContext *ctx, long long playouts);
+void mctsRun(MctsWorker *worker);
+void *mctsWorker(void *arg);
+SearchResult mctsBestMove(Position *pos, int player, SearchContext *ctx);
+long long integerSquareRoot(long long n);
+
+/* Batched Rule Moves */
+int batchFitsLanes(int rows, int cols);
+HOT_INLINE void laneWinningCells(const LaneVector *tokens, int rows, int cols, int sequenceNum, LaneVector *cells);
+void batchRuleMoves(const uint64_t tokens0[], const uint64_t tokens1[], const uint8_t players[], int count, int rows, int cols, int connectN, const int indexMap[MAX_COLS], int8_t moves[]);
+
+/* Pondering */
+int predictReply(const Position *pos, int player, const SearchContext *ctx);
+void *ponderWorker(void *arg);
+int startPonder(Ponder *ponder, const Position *pos, int human, const SearchContext *ctx);
+void stopPonder(Ponder *ponder, int reply, SearchContext *ctx);
+
+/* Batch Self-Play */
+void defaultBatchOptions(BatchOptions *batch);
+int parseBatchOption(BatchOptions *batch, const char *arg);
+int workerThreadCount(int requested);
+uint64_t mix64(uint64_t z);
+uint64_t nextRandom(uint64_t *state);
+char moveChar(int col);
+void playSelfPlayGame(Position *pos, const BoardOptions *board, SearchContext contexts[2], uint64_t rngState, int randomPlies, GameRecord *record);
+int selfPlayMove(Position *pos, int player, int col, GameRecord *record);
+void playSelfPlayRuleGames(const BoardOptions *board, const SearchContext *ctx, const uint64_t rngStates[], int randomPlies, GameRecord records[], int count);
+void *batchWorker(void *arg);
+void batchEmit(BatchJob *job, long long chunk, const GameRecord records[], int count);
+int runBatch(const EngineOptions *engine, const BatchOptions *batch, const BoardOptions *board);
+
+/* Game Records */
+void recordMoveString(const GameRecord *record, char moves[MAX_CELLS + 1]);
+int gameWriterOpen(FILE **file, const char *path, const BoardOptions *board);
+int gameWriterWrite(FILE *file, const GameRecord *record);
+int gameReaderOpen(GameReader *reader, const char *path, const BoardOptions *board);
+int gameReaderNext(GameReader *reader, GameRecord *record);
+int replayGame(const GameRecord *record, const BoardOptions *board, char grid[][MAX_COLS]);
+int runReplay(const char *path, const BatchOptions *batch, const BoardOptions *board);
+void *analysisWorker(void *arg);
+int runGameAnalysis(const EngineOptions *engine, const char *path, const BatchOptions *batch, const BoardOptions *board);
+
+/* Opening Book */
+void defaultBookOptions(BookOptions *bookOptions);
+int parseBookOption(BookOptions *bookOptions, const char *arg);
+int bookOpen(OpeningBook *book, const char *path, const BoardOptions *board);
+void bookClose(OpeningBook *book);
+int bookProbe(const OpeningBook *book, const Position *pos, int *score);
+int bookAddPosition(BookJob *job, const Position *pos);
+int bookCollect(BookJob *job, Position *pos, int player, int plies);
+void *bookWorker(void *arg);
+int compareBookRecords(const void *a, const void *b);
+int writeBook(const char *path, const BookRecord *records, long long count, const BoardOptions *board, int plies);
+int runMakeBook(const EngineOptions *engine, const BookOptions *bookOptions, const BatchOptions *batch, const BoardOptions *board);
+
+/* Endgame Database */
+void defaultEndgameOptions(EndgameOptions *endgameOptions);
+int parseEndgameOption(EndgameOptions *endgameOptions, const char *arg);
+uint64_t endgameSlot(uint64_t key, uint32_t displacement, uint64_t slots);
+int endgameOpen(EndgameTable *table, const char *path, const BoardOptions *board);
+void endgameClose(EndgameTable *table);
+int endgameProbe(const EndgameTable *table, const Position *pos, int *score);
+const EndgameRecord *endgameMemoFind(const EndgameMemo *memo, uint64_t key);
+int endgameMemoAdd(EndgameMemo *memo, uint64_t key, uint32_t entry);
+int endgameSolve(Position *pos, int player, const int order[MAX_COLS], EndgameMemo *memo);
+void *endgameWorker(void *arg);
+int compareEndgameRecords(const void *a, const void *b);
+int buildEndgameHash(const EndgameRecord *records, long long count, uint64_t buckets, uint64_t slots, uint32_t displacements[], uint64_t keys[], uint32_t entries[]);
+int writeEndgame(const char *path, const EndgameRecord *records, long long count, const BoardOptions *board, int cells);
+int runMakeEndgame(const EngineOptions *engine, const EndgameOptions *endgameOptions, const BatchOptions *batch, const BoardOptions *board);
+
+/* Game Server */
+void gamePoolInit(GamePool *pool);
+void gamePoolFree(GamePool *pool);
+ServerGame *gamePoolAlloc(GamePool *pool);
+void gamePoolRelease(GamePool *pool, ServerGame *game);
+ServerGame *gamePoolFind(GamePool *pool, unsigned long long id);
+unsigned long long gameId(const ServerGame *game);
+void *serverWorker(void *arg);
+void clientPrintf(ServerClient *client, const char *format, ...);
+int clientFlush(ServerClient *client);
+void serverCloseClient(GameServer *server, int clientIndex);
+void serverStartTurn(GameServer *server, ServerGame *game);
+void serverPlayMove(GameServer *server, ServerGame *game, int col);
+void serverCollectMoves(GameServer *server);
+void serverHandleLine(GameServer *server, int clientIndex, char *line);
+void serverRunLines(GameServer *server, int clientIndex);
+int serverReadClient(GameServer *server, int clientIndex);
+void clientReset(ServerClient *client, int inFd, int outFd);
+int serverAccept(GameServer *server);
+int runServer(const EngineOptions *engine, const BatchOptions *batch, const BoardOptions *board, const char *socketPath);
+
+/* Benchmarks */
+void defaultBenchOptions(BenchOptions *bench);
+int parseBenchOption(BenchOptions *bench, const char *arg);
+long long perftPosition(Position *pos, int player, int depth);
+long long perftBoard(char board[][MAX_COLS], int rows, int cols, int connectN, int player, int depth);
+long long expectedPerft(const BoardOptions *board, const char *moves, int depth);
+int runPerft(const BoardOptions *board, const char *moves, int maxDepth);
+void fillBenchSet(BenchSet *set, const BoardOptions *board, uint64_t seed);
+long long benchInsertToken(BenchSet *set, long long *sink);
+long long benchPositionPlay(BenchSet *set, long long *sink);
+long long benchSequenceScan(BenchSet *set, long long *sink);
+long long benchLastMoveCheck(BenchSet *set, long long *sink);
+long long benchPositionLastMove(BenchSet *set, long long *sink);
+long long benchPossibleSequence(BenchSet *set, long long *sink);
+long long benchPositionSequenceMove(BenchSet *set, long long *sink);
+long long benchComputerMove(BenchSet *set, long long *sink);
+long long benchPositionMove(BenchSet *set, long long *sink);
+long long benchBatchRuleMoves(BenchSet *set, long long *sink);
+void runMicroBenchmark(const char *name, BenchFunction function, BenchSet *set);
+void runLatencyBenchmark(const EngineOptions *engine, const BoardOptions *board, int games);
+int compareLongLong(const void *a, const void *b);
+int runBenchmarks(const EngineOptions *engine, const BenchOptions *bench, const BoardOptions *board);
+
+/* Consistency Fuzzer */
+void fuzzBoardSize(uint64_t *rngState, BoardOptions *board);
+int referenceSequenceMove(char board[][MAX_COLS], int rows, int cols, char playerToken, int sequenceNum, const int indexMap[MAX_COLS]);
+int referenceRuleMove(char board[][MAX_COLS], int rows, int cols, int connectN, int player, const int indexMap[MAX_COLS]);
+int fuzzMismatch(char *what, size_t size, const char *check, int arg, long long reference, long long optimized);
+int fuzzCheckPosition(const Position *pos, char board[][MAX_COLS], int player, int lastCol, const int order[MAX_COLS], char *what, size_t size);
+int fuzzGame(FuzzJob *job, long long game);
+void *fuzzWorker(void *arg);
+int runFuzz(const BatchOptions *batch, long long games);
+
+/* Tournament */
+void defaultTournamentOptions(TournamentOptions *tournament);
+int parseTournamentOption(TournamentOptions *tournament, const char *arg);
+int parsePlayerSpec(EngineOptions *player, const char *spec);
+long long loadOpenings(const char *path, const BoardOptions *board, GameRecord **openings);
+void tournamentPairing(int playerCount, long long pairing, int *first, int *second);
+void playTournamentGame(const TournamentJob *job, long long index, TournamentGame *game);
+void *tournamentWorker(void *arg);
+void tournamentEmit(TournamentJob *job, long long index, const TournamentGame *game);
+double naturalLog(double x);
+double squareRoot(double x);
+double eloFromScore(double score);
+void formatElo(char *text, size_t size, long long wins, long long draws, long long losses);
+int runTournament(const EngineOptions *engine, const TournamentOptions *tournament, const BatchOptions *batch, const BoardOptions *board);
+
+/* Counters */
+void countersFlush(void);
+void countersTotal(EngineCounters *total);
+void printCounters(const EngineCounters *counters, const long long moveNanos[], int moveCount);
+void dumpCounters(FILE *file, const EngineCounters *counters);
+
+/* Analysis */
+int moveFromChar(char c);
+int positionFromMoves(Position *pos, const BoardOptions *board, const char *moves);
+SearchResult analyzePosition(const Position *pos, int player, const EngineOptions *engine, int threads, double *seconds);
+int runAnalysis(const EngineOptions *engine, const BoardOptions *board, const char *moves);
+int runSolve(const EngineOptions *engine, const BoardOptions *board, const char *moves, int weak);
+
+/* Library API: the functions declared in ex3.h */
 
 /* Main Execution */
-void runConnectFour(char[][COLS], int, int, int, int);
-int main();
-
-
-int main() {
-    char board[ROWS][COLS];
-    printf("Connect Four (%d rows x %d cols)\n\n", ROWS, COLS);
-    int p1Type = getPlayerType(1);
-    int p2Type = getPlayerType(2);
-    initBoard(board, ROWS, COLS);
-    printBoard(board, ROWS, COLS);
-    runConnectFour(board, ROWS, COLS, p1Type, p2Type);
-    return 0;
+void runConnectFour(char[][MAX_COLS], int, int, int, int);
+void runConnectFourWithOptions(char board[][MAX_COLS], int rows, int cols, int connectN, int player1Type, int player2Type, const EngineOptions *options);
+int playPositionQueary(Position *pos, char board[][MAX_COLS], SearchContext *ctx, int numPlayer, int playerType, GameOutput *out);
+void commitMove(Position *pos, char board[][MAX_COLS], int player, int col);
+void printUsage(const char *program);
+int main(int argc, char *argv[]);
+
+
+#ifndef EX3_LIBRARY
+int main(int argc, char *argv[]) {
+    char board[MAX_ROWS][MAX_COLS];
+    EngineOptions options;
+    BatchOptions batch;
+    BoardOptions size;
+    BookOptions bookOptions;
+    EndgameOptions endgameOptions;
+    BenchOptions bench;
+    TournamentOptions tournament;
+    defaultEngineOptions(&options);
+    defaultBatchOptions(&batch);
+    defaultBoardOptions(&size);
+    defaultBookOptions(&bookOptions);
+    defaultEndgameOptions(&endgameOptions);
+    defaultBenchOptions(&bench);
+    defaultTournamentOptions(&tournament);
+    const char *analyzeMoves = NULL;
+    const char *replayPath = NULL;
+    const char *analyzeGamesPath = NULL;
+    const char *solveMoves = NULL;
+    int solveWeak = 0;
+    long long fuzzGames = 0;
+    int serve = 0;
+    const char *socketPath = NULL;
+    for (int i = 1; i < argc; i++){
+        if (strncmp(argv[i], "--analyze=", 10) == 0)
+            analyzeMoves = argv[i] + 10;
+        else if (strncmp(argv[i], "--replay=", 9) == 0)
+            replayPath = argv[i] + 9;
+        else if (strncmp(argv[i], "--analyze-games=", 16) == 0)
+            analyzeGamesPath = argv[i] + 16;
+        else if (strcmp(argv[i], "--server") == 0)
+            serve = 1;
+        else if (strncmp(argv[i], "--server=", 9) == 0 && argv[i][9] != '\0'){
+            serve = 1;
+            socketPath = argv[i] + 9;
+        }
+        else if (strncmp(argv[i], "--solve=", 8) == 0)
+            solveMoves = argv[i] + 8;
+        else if (strncmp(argv[i], "--fuzz=", 7) == 0 && atoll(argv[i] + 7) > 0)
+            fuzzGames = atoll(argv[i] + 7);
+        else if (strcmp(argv[i], "--solve-mode=weak") == 0 || strcmp(argv[i], "--solve-mode=strong") == 0)
+            solveWeak = strcmp(argv[i], "--solve-mode=weak") == 0;
+        else if (!parseEngineOption(&options, argv[i]) && !parseBatchOption(&batch, argv[i])
+            && !parseBoardOption(&size, argv[i]) && !parseBookOption(&bookOptions, argv[i])
+            && !parseEndgameOption(&endgameOptions, argv[i]) && !parseBenchOption(&bench, argv[i])
+            && !parseTournamentOption(&tournament, argv[i])){
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (!isValidBoardSize(size.rows, size.cols, size.connectN)){
+        fprintf(stderr, "Unsupported board: %d rows x %d cols, connect %d.\n", size.rows, size.cols, size.connectN);
+        return 1;
+    }
+
+    if (bookOptions.path != NULL)
+        return runMakeBook(&options, &bookOptions, &batch, &size) ? 0 : 1;
+    if (endgameOptions.path != NULL)
+        return runMakeEndgame(&options, &endgameOptions, &batch, &size) ? 0 : 1;
+
+    OpeningBook book;
+    if (options.bookPath != NULL){
+        if (!bookOpen(&book, options.bookPath, &size))
+            return 1;
+        options.book = &book;
+    }
+    EndgameTable endgame;
+    if (options.endgamePath != NULL){
+        if (!endgameOpen(&endgame, options.endgamePath, &size)){
+            if (options.book != NULL)
+                bookClose(&book);
+            return 1;
+        }
+        options.endgame = &endgame;
+    }
+
+    int status = 0;
+    if (bench.enabled){
+        status = runBenchmarks(&options, &bench, &size) ? 0 : 1;
+    }
+    else if (fuzzGames > 0){
+        status = runFuzz(&batch, fuzzGames) ? 0 : 1;
+    }
+    else if (tournament.games > 0){
+        status = runTournament(&options, &tournament, &batch, &size) ? 0 : 1;
+    }
+    else if (analyzeMoves != NULL){
+        status = runAnalysis(&options, &size, analyzeMoves) ? 0 : 1;
+    }
+    else if (serve){
+        status = runServer(&options, &batch, &size, socketPath) ? 0 : 1;
+    }
+    else if (solveMoves != NULL){
+        status = runSolve(&options, &size, solveMoves, solveWeak) ? 0 : 1;
+    }
+    else if (replayPath != NULL){
+        status = runReplay(replayPath, &batch, &size) ? 0 : 1;
+    }
+    else if (analyzeGamesPath != NULL){
+        status = runGameAnalysis(&options, analyzeGamesPath, &batch, &size) ? 0 : 1;
+    }
+    else if (batch.games > 0){
+        status = runBatch(&options, &batch, &size) ? 0 : 1;
+    }
+    else{
+        printf("Connect Four (%d rows x %d cols)\n\n", size.rows, size.cols);
+        int p1Type = getPlayerType(1);
+        int p2Type = getPlayerType(2);
+        initBoard(board, size.rows, size.cols);
+        runConnectFourWithOptions(board, size.rows, size.cols, size.connectN, p1Type, p2Type, &options);
+    }
+
+    if (options.book != NULL)
+        bookClose(&book);
+    if (options.endgame != NULL)
+        endgameClose(&endgame);
+    return status;
+}
+#endif
+
+void printUsage(const char *program){
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "  --rows=N --cols=N  board size (default %d x %d, up to %d x %d as long as\n", ROWS, COLS, MAX_ROWS, MAX_COLS);
+    fprintf(stderr, "                     (rows + 1) * cols <= %d)\n", BITBOARD_BITS);
+    fprintf(stderr, "  --connect=N        tokens in a row needed to win (default %d)\n", CONNECT_N);
+    fprintf(stderr, "  --ai=rule|search|max|mcts  computer player: priority rules (default), alpha-beta\n");
+    fprintf(stderr, "                     search, perfect play from the solver (max) or Monte Carlo tree\n");
+    fprintf(stderr, "                     search for big boards; max falls back to the search when a solve\n");
+    fprintf(stderr, "                     takes longer than --time-ms (default %d), mcts thinks for\n", DEFAULT_SOLVE_MS);
+    fprintf(stderr, "                     --time-ms (default %d) or --nodes playouts\n", DEFAULT_MCTS_MS);
+    fprintf(stderr, "  --depth=N          deepest search iteration (default %d)\n", DEFAULT_SEARCH_DEPTH);
+    fprintf(stderr, "  --time-ms=N        search time budget per move in milliseconds\n");
+    fprintf(stderr, "  --nodes=N          search node budget per move\n");
+    fprintf(stderr, "  --tt-mb=N          transposition table size in MB, 0 disables it (default %d);\n", DEFAULT_TT_MB);
+    fprintf(stderr, "                     the tree of --ai=mcts, which plays the rules without one\n");
+    fprintf(stderr, "  --eval=threats|center  search leaf score: open windows and threats by row parity\n");
+    fprintf(stderr, "                     on top of center weighting (default), or center weighting only\n");
+    fprintf(stderr, "  --search-threads=N threads searching each move, sharing the table (default 1)\n");
+    fprintf(stderr, "  --ponder           search the predicted reply while a human opponent thinks\n");
+    fprintf(stderr, "  --render=full|compact|diff|quiet  board shown after every move of a game: the\n");
+    fprintf(stderr, "                     whole board (default), without borders, only the new token,\n");
+    fprintf(stderr, "                     or none and no computer moves either (for timing games)\n");
+    fprintf(stderr, "  --stats            after a game print the hot path counters and the time of every\n");
+    fprintf(stderr, "                     computer move; after a batch dump them as key=value on stderr\n");
+    fprintf(stderr, "  --analyze=MOVES    search the position after MOVES (columns as in the batch output)\n");
+    fprintf(stderr, "                     and print the result; with several search threads the speedup\n");
+    fprintf(stderr, "                     over one thread is measured too\n");
+    fprintf(stderr, "  --solve=MOVES      solve the position after MOVES to the end of the game\n");
+    fprintf(stderr, "  --solve-mode=weak|strong  win, draw or loss only, or also the exact number of\n");
+    fprintf(stderr, "                     plies to the end of the game (default strong)\n");
+    fprintf(stderr, "  --book=FILE        play the opening from a book made with --make-book\n");
+    fprintf(stderr, "  --make-book=FILE   search every position of the first plies with the search\n");
+    fprintf(stderr, "                     options above and write the results as an opening book\n");
+    fprintf(stderr, "  --book-plies=N     tokens on the board in the deepest book position (default %d)\n", DEFAULT_BOOK_PLIES);
+    fprintf(stderr, "  --endgame=FILE     play late positions from an endgame database\n");
+    fprintf(stderr, "  --make-endgame=FILE  solve every position after the first one with at most\n");
+    fprintf(stderr, "                     --endgame-cells empty cells of --batch self-play games\n");
+    fprintf(stderr, "                     (default %d) on --threads workers and write the results\n", DEFAULT_ENDGAME_GAMES);
+    fprintf(stderr, "  --endgame-cells=N  empty cells in the earliest database position (default %d)\n", DEFAULT_ENDGAME_CELLS);
+    fprintf(stderr, "  --server[=SOCKET]  host many games over a line protocol on stdin/stdout, or on a\n");
+    fprintf(stderr, "                     Unix socket; computer moves run on --threads workers. commands:\n");
+    fprintf(stderr, "                     new [h|c] [h|c], play ID COL, board ID, end ID, games, shutdown\n");
+    fprintf(stderr, "  --bench            run perft, microbenchmarks and a move latency histogram\n");
+    fprintf(stderr, "  --perft-depth=N    deepest perft of --bench (default %d)\n", DEFAULT_PERFT_DEPTH);
+    fprintf(stderr, "  --bench-games=N    self-play games timed by --bench (default %d)\n", DEFAULT_BENCH_GAMES);
+    fprintf(stderr, "  --fuzz=N           play N random games on random board sizes on --threads workers\n");
+    fprintf(stderr, "                     and check after every move that the bitboard engine agrees\n");
+    fprintf(stderr, "                     with the char board functions; --seed picks the games\n");
+    fprintf(stderr, "  --tournament=N     round robin of the --player engines, N games per pairing on\n");
+    fprintf(stderr, "                     --threads workers, every opening played with both colors; prints\n");
+    fprintf(stderr, "                     win/draw/loss, Elo with its 95%% interval, time per move, nodes/s\n");
+    fprintf(stderr, "  --player=OPTIONS   a tournament player: engine options without their dashes, comma\n");
+    fprintf(stderr, "                     separated, on top of the command line's (ai=search,depth=6)\n");
+    fprintf(stderr, "  --openings=FILE    tournament openings from a game file of unfinished games, instead\n");
+    fprintf(stderr, "                     of --random-plies random moves\n");
+    fprintf(stderr, "  --batch=N          play N computer vs computer games without a board and print\n");
+    fprintf(stderr, "                     one line per game: <game> <winner> <length> <moves>\n");
+    fprintf(stderr, "  --threads=N        batch, book, endgame and tournament worker threads (default one\n");
+    fprintf(stderr, "                     per core)\n");
+    fprintf(stderr, "  --seed=N           batch random seed (default 1)\n");
+    fprintf(stderr, "  --random-plies=N   random opening moves per batch game (default %d)\n", DEFAULT_RANDOM_PLIES);
+    fprintf(stderr, "  --record=FILE      also write the batch (or replayed) games to a binary game file\n");
+    fprintf(stderr, "  --replay=FILE      check every game of a binary or text game file by replaying it\n");
+    fprintf(stderr, "                     and print it in the batch format\n");
+    fprintf(stderr, "  --analyze-games=FILE  search every position of every game in a game file on\n");
+    fprintf(stderr, "                     --threads workers and print per game the engine's moves and\n");
+    fprintf(stderr, "                     scores: <game> <played moves> <engine moves> <scores>\n");
 }
 
-void printBoard(char board[][COLS], int rows, int cols) {
-    printf("\n");
+void printBoard(char board[][MAX_COLS], int rows, int cols) {
+    renderBoard(board, rows, cols, writeFile, stdout);
+}
+
+void renderBoard(char board[][MAX_COLS], int rows, int cols, Ex3Write write, void *user){
+    //the whole board as one piece of text: a line per row, then the column numbers
+    char text[1 + (MAX_ROWS + 1) * (2 * MAX_COLS + 2)];
+    size_t length = 0;
+    text[length++] = '\n';
     for (int r = 0; r < rows; r++) {
-        printf("|");
+        text[length++] = '|';
         for (int c = 0; c < cols; c++) {
-            putchar(board[r][c]);
-            printf("|");
+            text[length++] = board[r][c];
+            text[length++] = '|';
         }
-        printf("\n");
+        text[length++] = '\n';
     }
     for (int c = 1; c <= cols; c++) {
-        printf(" %d", c % 10);
+        text[length++] = ' ';
+        text[length++] = (char)('0' + c % 10);
+    }
+    text[length++] = '\n';
+    text[length++] = '\n';
+    write(user, text, length);
+}
+
+void writeFile(void *user, const char *text, size_t length){
+    //Ex3Write for a stdio stream
+    fwrite(text, 1, length, (FILE *)user);
+}
+
+void renderCompactBoard(char board[][MAX_COLS], int rows, int cols, Ex3Write write, void *user){
+    //renderBoard without the borders and the spacing, about half the text
+    char text[1 + (MAX_ROWS + 1) * (MAX_COLS + 1) + 1];
+    size_t length = 0;
+    text[length++] = '\n';
+    for (int r = 0; r < rows; r++) {
+        memcpy(text + length, board[r], (size_t)cols);
+        length += (size_t)cols;
+        text[length++] = '\n';
+    }
+    for (int c = 1; c <= cols; c++)
+        text[length++] = (char)('0' + c % 10);
+    text[length++] = '\n';
+    text[length++] = '\n';
+    write(user, text, length);
+}
+
+void renderMove(GameOutput *out, char board[][MAX_COLS], int rows, int cols, int col){
+    //shows the board after a token fell into col, or the empty board for col -1.
+    //the diff mode shows the empty board once so the size is known, then only new tokens.
+    if (out->mode == RENDER_QUIET)
+        return;
+    if (out->mode == RENDER_COMPACT){
+        renderCompactBoard(board, rows, cols, outputWrite, out);
+        return;
+    }
+    if (out->mode == RENDER_FULL || col == -1){
+        renderBoard(board, rows, cols, outputWrite, out);
+        return;
+    }
+    int row = 0;
+    while (board[row][col] == EMPTY)
+        row++;
+    outputPrintf(out, "\n%c in column %d, row %d\n\n", board[row][col], col + 1, rows - row);
+}
+
+void outputInit(GameOutput *out, int mode, int fd){
+    out->mode = mode;
+    out->fd = fd;
+    out->length = 0;
+}
+
+void outputWrite(void *user, const char *text, size_t length){
+    //Ex3Write for a GameOutput, it only writes when the buffer fills up
+    GameOutput *out = user;
+    if (out->length + length > OUTPUT_BUFFER){
+        outputFlush(out);
+        if (length > OUTPUT_BUFFER){
+            writeFully(out->fd, text, length);
+            return;
+        }
+    }
+    memcpy(out->text + out->length, text, length);
+    out->length += length;
+}
+
+void outputPrintf(GameOutput *out, const char *format, ...){
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length > 0)
+        outputWrite(out, line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1);
+}
+
+void outputFlush(GameOutput *out){
+    //one write for everything since the last flush. prompts printed through stdio
+    //go out first, so the text stays in order.
+    if (out->length == 0)
+        return;
+    fflush(stdout);
+    writeFully(out->fd, out->text, out->length);
+    out->length = 0;
+}
+
+void writeFully(int fd, const char *text, size_t length){
+    //write retried until everything is out; on an error the rest is dropped
+    while (length > 0){
+        ssize_t n = write(fd, text, length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        text += n;
+        length -= (size_t)n;
     }
-    printf("\n\n");
 }
 
 int getPlayerType(int playerNumber) {
@@ -93,14 +1304,14 @@ int getPlayerType(int playerNumber) {
     }
 }
 
-void initBoard(char board[][COLS] , int rows, int cols){
+void initBoard(char board[][MAX_COLS] , int rows, int cols){
     for (int row = 0; row < rows; row++)
         for (int col = 0;  col < cols; col++)
             //SET BORAD POSITION AS EMPTY
             board[row][col] = EMPTY;
 }
 
-int checkIfNumSequenceForPlayer(char playerToken, char board[][COLS], int rows, int cols, int inSequenceNum){
+int checkIfNumSequenceForPlayer(char playerToken, char board[][MAX_COLS], int rows, int cols, int inSequenceNum){
  /**
      * @brief Checks if a specific player has achieved a winning sequence on the board.
      * * @param playerToken The character token of the player to check (TOKEN_P1 or TOKEN_P2).
@@ -111,6 +1322,7 @@ int checkIfNumSequenceForPlayer(char playerToken, char board[][COLS], int rows,
      * @return int Returns 1 if the player has 'inSequenceNum' tokens consecutively 
      * (horizontally, vertically, or diagonally). Returns 0 otherwise.
      */
+    threadCounters.winChecks++;
 
     if (inSequenceNum < 2)
         return 0; //No Sequence if Below 2
@@ -183,118 +1395,59 @@ int checkIfNumSequenceForPlayer(char playerToken, char board[][COLS], int rows,
 }
 
 
-int checkIfNumSequenceForPlayerBecauseOfLastMove(char playerToken, char board[][COLS], int rows, int cols, int inSequenceNum, int lastMoveRow, int lastMoveCol){
+int checkIfNumSequenceForPlayerBecauseOfLastMove(char playerToken, char board[][MAX_COLS], int rows, int cols, int inSequenceNum, int lastMoveRow, int lastMoveCol){
  /**
-     * @brief Checks if a specific player has achieved a winning sequence on the board.
+     * @brief Checks if the last move completed a winning sequence for a specific player.
      * * @param playerToken The character token of the player to check (TOKEN_P1 or TOKEN_P2).
      * @param board The current state of the game board.
      * @param rows The number of rows in the board.
      * @param cols The number of columns in the board.
      * @param inSequenceNum The required length of the sequence (e.g., 4 for Connect Four).
-     * @return int Returns 1 if the player has 'inSequenceNum' tokens consecutively 
-     * (horizontally, vertically, or diagonally). Returns 0 otherwise.
+     * @param lastMoveRow The row of the token that was just inserted.
+     * @param lastMoveCol The column of the token that was just inserted.
+     * @return int Returns 1 if the token at the last move is part of 'inSequenceNum' tokens
+     * of the player in a row (horizontally, vertically, or diagonally). Returns 0 otherwise.
      */
+    threadCounters.winChecks++;
 
     if (inSequenceNum < 2)
         return 0; //No Sequence if Below 2
-    
-    //bounding box
-    int minRow = lastMoveRow - inSequenceNum > 0 ? lastMoveRow - inSequenceNum : 0;
-    int maxRow = lastMoveRow + inSequenceNum < rows ? lastMoveRow + inSequenceNum : rows;
-    int minCol = lastMoveCol - inSequenceNum > 0 ? lastMoveCol - inSequenceNum : 0;
-    int maxCol = lastMoveCol + inSequenceNum < cols ? lastMoveCol + inSequenceNum : cols;
-
-    // Start of the function body
-    for (int row = minRow; row < maxRow; row++) {
-        for (int col = minCol; col < maxCol; col++) {
-            //if not this player skip to the next position
-            int counter = 0;
 
-            if (board[row][col] != playerToken)
-                continue;
+    if (board[lastMoveRow][lastMoveCol] != playerToken)
+        return 0;
 
-            if ((row == lastMoveRow) && (col == lastMoveCol))
+    //east, south east, south and south west; each line is walked both ways from the last move,
+    //so only the at most 4 * (inSequenceNum - 1) cells that can share a sequence with it are read
+    const int rowSteps[4] = {0, 1, 1, 1};
+    const int colSteps[4] = {1, 1, 0, -1};
+    for (int dir = 0; dir < 4; dir++){
+        int counter = 1;
+        for (int sign = -1; sign <= 1; sign += 2){
+            int row = lastMoveRow + sign * rowSteps[dir];
+            int col = lastMoveCol + sign * colSteps[dir];
+            while (counter < inSequenceNum && isInBounds(row, col, rows, cols) && board[row][col] == playerToken){
                 counter++;
-            
-          
-            //check south east
-            if ((cols - col > inSequenceNum - 1) && (rows - row > inSequenceNum - 1)){
-                int flag = 1;
-                int innerCount = 0;
-                for (int shift = 1; shift < inSequenceNum; shift++){
-                    if ((row + shift == lastMoveRow) && (col + shift == lastMoveCol))
-                        innerCount++;
-                    if (board[row + shift][col + shift] != playerToken){
-                        flag = 0;
-                        break;
-                    }
-                }
-                if (flag && ((counter + innerCount) == 1)){
-                    return 1;
-                }
-            }
-            //check south
-            if (rows - row > inSequenceNum - 1){
-                int flag = 1;
-                int innerCount = 0;
-                for (int shift = 1; shift < inSequenceNum ; shift++){
-                    if ((row + shift == lastMoveRow) && (col == lastMoveCol))
-                        innerCount++;
-                    if (board[row + shift][col] != playerToken){
-                        flag = 0;
-                        break;
-                    }
-                }
-                if (flag && ((counter + innerCount) == 1)){
-                    return 1;
-                }
-            }
-
-            //check south west
-            if ((col >= inSequenceNum - 1) && (rows - row > inSequenceNum - 1)){
-                int flag = 1;
-                int innerCount = 0;
-                for (int shift = 1; shift < inSequenceNum; shift++){
-                    if ((row + shift == lastMoveRow) && (col - shift == lastMoveCol))
-                        innerCount++;
-
-                    if (board[row + shift][col - shift] != playerToken){
-                        flag = 0;
-                        break;
-                    }
-                }
-                if (flag && ((counter + innerCount) == 1)){
-                    return 1;
-                }
-            }
-
-            //check east (row stays the same colum changes)
-            if (cols - col > inSequenceNum - 1){
-                int flag = 1;
-                int innerCount = 0;
-                for (int shift = 1; shift < inSequenceNum; shift++){
-                    if ((row == lastMoveRow) && (col + shift == lastMoveCol))
-                        innerCount++;
-                    if (board[row][col + shift] != playerToken){
-                        flag = 0;
-                        break;
-                    }
-                }
-                if (flag && ((counter + innerCount) == 1)){
-                    return 1;
-                }
+                row += sign * rowSteps[dir];
+                col += sign * colSteps[dir];
             }
         }
+        if (counter >= inSequenceNum)
+            return 1;
     }
-    
+
     return 0;
 }
 
-int insertToken(char board[][COLS], int rows, int cols, char playerToken, int insertCol){
+int isInBounds(int row, int col, int rows, int cols){
+    return row > -1 && row < rows && col > -1 && col < cols;
+}
+
+int insertToken(char board[][MAX_COLS], int rows, int cols, char playerToken, int insertCol){
     //The functions inserts a playerToken to a selected column, if player inserted an invalid column (insertCol)
     //then return 0
     //if column is full,  the action cannot happen, returns 0
     //if action is successfull return 1
+    threadCounters.tokenInserts++;
 
     if ((insertCol < 0) || (insertCol > cols - 1))
         //invalid insertCol Value
@@ -320,11 +1473,12 @@ int insertToken(char board[][COLS], int rows, int cols, char playerToken, int in
 
 }
 
-int uninsertToken(char board[][COLS], int rows, int cols, int insertCol){
+int uninsertToken(char board[][MAX_COLS], int rows, int cols, int insertCol){
     //get the last token inserted in a column
     //cehck if the column is valid if not return 0
     //if the column is empty return 0, action failed
     //if the action succeeded return 1
+    threadCounters.tokenUninserts++;
     if ((insertCol < 0) || (insertCol > cols - 1))
         //invalid insertCol Value
         return 0;
@@ -349,93 +1503,4962 @@ int uninsertToken(char board[][COLS], int rows, int cols, int insertCol){
 }
 
 
-int checkPlayerForPossibleSequence(char board [][COLS], int rows, int cols, char playerToken, int sequenceNum, int indexMap[COLS]){
-    //in each column we will insert the next move, 
-    //and for each updated position we will check wether the player has a sequence of sequenceNum.
-    //if he has the sequence return the move that created the sequence
-    //else return -1, no move will create a sequence of sequenceNum
-    int isInserted, isSequence;
-    for (int col = 0; col < cols; col++){
-        int colToCheckFirst = indexMap[col];
-        isInserted = insertToken(board, rows, cols, playerToken, colToCheckFirst);
+int playerIndex(char playerToken){
+    //bitboard slot of a token: 0 for player 1, 1 for player 2
+    return playerToken == TOKEN_P1 ? 0 : 1;
+}
 
-        if (!isInserted){
-            //sequence is not possible at this column
-            continue;
-        }
-        
-        //get row index of the inserted item
-        int columnHeight = getColumnHeight(board, rows, colToCheckFirst);
-        int rowIndexInsert = rows - columnHeight;
-
-        //if we succeeded making the move check for a sequence of 3
-        isSequence = checkIfNumSequenceForPlayerBecauseOfLastMove(playerToken, board, rows, cols, sequenceNum, rowIndexInsert, colToCheckFirst);
-        uninsertToken(board, rows, cols, colToCheckFirst);
-        if (isSequence){
-            return colToCheckFirst;
-        }
+void defaultBoardOptions(BoardOptions *board){
+    board->rows = ROWS;
+    board->cols = COLS;
+    board->connectN = CONNECT_N;
+}
 
+int parseBoardOption(BoardOptions *board, const char *arg){
+    //same contract as parseEngineOption; the combination is checked by isValidBoardSize
+    if (strncmp(arg, "--rows=", 7) == 0){
+        board->rows = atoi(arg + 7);
+        return 1;
     }
-    return -1;
+    if (strncmp(arg, "--cols=", 7) == 0){
+        board->cols = atoi(arg + 7);
+        return 1;
+    }
+    if (strncmp(arg, "--connect=", 10) == 0){
+        board->connectN = atoi(arg + 10);
+        return 1;
+    }
+    return 0;
 }
 
-int generateComputerPlayerMove(char board [][COLS], int rows, int cols, char playerToken, char opposingPlayerToken, int whatColsToCheckFirst[COLS]){
-
-    //WE ASSUME THE BOARD IS NOT FULL WHEN USING THIS FUNCTION!!!!
+int isValidBoardSize(int rows, int cols, int connectN){
+    //every column needs rows + 1 bits of the bitboard
+    return rows > 0 && rows <= MAX_ROWS && cols > 0 && cols <= MAX_COLS
+        && (rows + 1) * cols <= BITBOARD_BITS && connectN >= 2;
+}
 
-    // Priority order
-    // 1. Winning move - if it is possible to win on the next move - choose the column that produces the win.
-    // 2. Blocking the opponent - if the opponent can win on their next move choose the column that prevents this.
-    // 3. Creating a sequence of three - if it is possible to create a sequence of three tokens do so.
-    // 4. Blocking the opponent’s sequence of three.
-    // 5. Choosing according to the arbitrary ordering rule.
+int geometryOf(int rows, int cols, int connectN){
+    if (rows == 6 && cols == 7 && connectN == 4)
+        return GEOMETRY_6X7_4;
+    if (rows == 7 && cols == 8 && connectN == 4)
+        return GEOMETRY_7X8_4;
+    if (rows == 9 && cols == 10 && connectN == 5 && BITBOARD_BITS >= 100)
+        return GEOMETRY_9X10_5;
+    return (rows + 1) * cols <= 64 ? GEOMETRY_NARROW : GEOMETRY_WIDE;
+}
 
-    // Ordering rule for columns
+void positionInit(Position *pos, int rows, int cols, int connectN){
+    //we assume the size was checked with isValidBoardSize
+    pos->tokens[0] = 0;
+    pos->tokens[1] = 0;
+    pos->occupied = 0;
+    pos->rows = rows;
+    pos->cols = cols;
+    pos->connectN = connectN;
+    pos->geometry = geometryOf(rows, cols, connectN);
+    pos->moveCount = 0;
+    pos->hash = 0;
+    pos->mirrorHash = 0;
+    for (int col = 0; col < cols; col++){
+        pos->heights[col] = 0;
+        pos->mirrorShift[col] = (int16_t)((cols - 1 - 2 * col) * (rows + 1));
+    }
+}
+
+void positionLoad(Position *pos, char board[][MAX_COLS], int rows, int cols, int connectN){
+    //build the bitboards from a char board, walking every column bottom up
+    positionInit(pos, rows, cols, connectN);
+    for (int col = 0; col < cols; col++){
+        int height = 0;
+        while (height < rows && board[rows - 1 - height][col] != EMPTY){
+            int player = playerIndex(board[rows - 1 - height][col]);
+            Bitboard bit = positionCellBit(pos, height, col);
+            pos->tokens[player] |= bit;
+            pos->occupied |= bit;
+            int index = positionBitIndex(pos, height, col);
+            pos->hash ^= zobristKeys[player][index];
+            pos->mirrorHash ^= zobristKeys[player][index + pos->mirrorShift[col]];
+            height++;
+        }
+        pos->heights[col] = height;
+        pos->moveCount += height;
+    }
+}
+
+int positionBitIndex(const Position *pos, int row, int col){
+    //row is counted from the bottom of the board
+    return col * (pos->rows + 1) + row;
+}
+
+Bitboard positionCellBit(const Position *pos, int row, int col){
+    return (Bitboard)1 << positionBitIndex(pos, row, col);
+}
+
+int positionCanPlay(const Position *pos, int col){
+    return col > -1 && col < pos->cols && pos->heights[col] < pos->rows;
+}
+
+int positionPlay(Position *pos, int player, int col){
+    //same contract as insertToken: returns 0 for an invalid or full column, 1 on success
+    threadCounters.positionPlays++;
+    if (!positionCanPlay(pos, col))
+        return 0;
+
+    int index = positionBitIndex(pos, pos->heights[col], col);
+    Bitboard bit = (Bitboard)1 << index;
+    pos->tokens[player] |= bit;
+    pos->occupied |= bit;
+    pos->hash ^= zobristKeys[player][index];
+    pos->mirrorHash ^= zobristKeys[player][index + pos->mirrorShift[col]];
+    pos->heights[col]++;
+    pos->moveCount++;
+    return 1;
+}
+
+int positionUndo(Position *pos, int col){
+    //same contract as uninsertToken: returns 0 for an invalid or empty column, 1 on success
+    threadCounters.positionUndos++;
+    if ((col < 0) || (col > pos->cols - 1) || pos->heights[col] == 0)
+        return 0;
+
+    pos->heights[col]--;
+    pos->moveCount--;
+    int index = positionBitIndex(pos, pos->heights[col], col);
+    Bitboard bit = (Bitboard)1 << index;
+    int player = (pos->tokens[0] & bit) ? 0 : 1;
+    pos->hash ^= zobristKeys[player][index];
+    pos->mirrorHash ^= zobristKeys[player][index + pos->mirrorShift[col]];
+    pos->tokens[player] ^= bit;
+    pos->occupied ^= bit;
+    return 1;
+}
+
+int positionIsFull(const Position *pos){
+    return pos->moveCount == pos->rows * pos->cols;
+}
+
+int positionHasSequence(const Position *pos, int player, int sequenceNum){
+    //shift-and-AND: after k rounds a bit survives only if it starts a run of k + 1 tokens.
+    //the shifts are vertical, horizontal and the two diagonals of the column-major layout.
+    threadCounters.winChecks++;
+    if (sequenceNum < 2)
+        return 0; //No Sequence if Below 2
+
+    const int shifts[4] = {1, pos->rows + 1, pos->rows, pos->rows + 2};
+    for (int dir = 0; dir < 4; dir++){
+        Bitboard runs = pos->tokens[player];
+        for (int k = 1; k < sequenceNum && runs; k++)
+            runs &= runs >> shifts[dir];
+        if (runs)
+            return 1;
+    }
+    return 0;
+}
+
+int positionMoveMakesSequence(const Position *pos, int player, int col, int sequenceNum){
+    //bitboard counterpart of checkIfNumSequenceForPlayerBecauseOfLastMove: the top token of
+    //col must lie inside a run of sequenceNum tokens of the player
+    if (pos->heights[col] == 0 || !(pos->tokens[player] & positionCellBit(pos, pos->heights[col] - 1, col)))
+        return 0;
+    return positionCellInSequence(pos, player, pos->heights[col] - 1, col, sequenceNum);
+}
+
+int positionCellInSequence(const Position *pos, int player, int row, int col, int sequenceNum){
+    //would a token of player at (row, col), placed there or already there, be inside a run of
+    //sequenceNum? the common sizes get a copy of the check with the shifts (and the run length
+    //of the win check) fixed at compile time; boards that fit in 64 bits never touch the high word.
+    threadCounters.winChecks++;
+    switch (pos->geometry){
+    case GEOMETRY_6X7_4:
+        if (sequenceNum == 4)
+            return cellInSequenceNarrow((uint64_t)pos->tokens[player], 1ULL << (col * 7 + row), 6, 4);
+        return cellInSequenceNarrow((uint64_t)pos->tokens[player], 1ULL << (col * 7 + row), 6, sequenceNum);
+    case GEOMETRY_7X8_4:
+        if (sequenceNum == 4)
+            return cellInSequenceNarrow((uint64_t)pos->tokens[player], 1ULL << (col * 8 + row), 7, 4);
+        return cellInSequenceNarrow((uint64_t)pos->tokens[player], 1ULL << (col * 8 + row), 7, sequenceNum);
+    case GEOMETRY_9X10_5:
+        if (sequenceNum == 5)
+            return cellInSequenceWide(pos->tokens[player], (Bitboard)1 << (col * 10 + row), 9, 5);
+        return cellInSequenceWide(pos->tokens[player], (Bitboard)1 << (col * 10 + row), 9, sequenceNum);
+    case GEOMETRY_NARROW:
+        return cellInSequenceNarrow((uint64_t)pos->tokens[player], 1ULL << positionBitIndex(pos, row, col), pos->rows, sequenceNum);
+    default:
+        return cellInSequenceWide(pos->tokens[player], positionCellBit(pos, row, col), pos->rows, sequenceNum);
+    }
+}
+
+HOT_INLINE int cellInSequenceNarrow(uint64_t tokens, uint64_t cell, int rows, int sequenceNum){
+    //per line: runs keeps the cells that start sequenceNum tokens in a row, starts the cells
+    //from which such a run would cover cell. sequenceNum - 1 shifts per line and no branches
+    //until the test, which unrolls completely when rows and sequenceNum are constants.
+    if (sequenceNum < 2)
+        return 0;
+
+    tokens |= cell;
+    const int shifts[4] = {1, rows + 1, rows, rows + 2};
+    for (int dir = 0; dir < 4; dir++){
+        //a line that would need to shift by 64 or more cannot hold the run on a narrow board
+        if ((sequenceNum - 1) * shifts[dir] >= 64)
+            continue;
+        uint64_t runs = tokens;
+        uint64_t starts = cell;
+        for (int k = 1; k < sequenceNum; k++){
+            runs &= tokens >> (k * shifts[dir]);
+            starts |= cell >> (k * shifts[dir]);
+        }
+        if (runs & starts)
+            return 1;
+    }
+    return 0;
+}
+
+HOT_INLINE int cellInSequenceWide(Bitboard tokens, Bitboard cell, int rows, int sequenceNum){
+    //counts the player's tokens outward from cell along each of the four lines, so the cost is
+    //O(sequenceNum) whatever the board size; on 128 bits this beats shifting the whole board.
+    //the empty sentinel row and the ends of the bitboard stop every walk at the board edge.
+    if (sequenceNum < 2)
+        return 0;
+
+    tokens |= cell;
+    const int shifts[4] = {1, rows + 1, rows, rows + 2};
+    for (int dir = 0; dir < 4; dir++){
+        int count = 1;
+        for (Bitboard next = cell << shifts[dir]; count < sequenceNum && (tokens & next); next <<= shifts[dir])
+            count++;
+        for (Bitboard next = cell >> shifts[dir]; count < sequenceNum && (tokens & next); next >>= shifts[dir])
+            count++;
+        if (count >= sequenceNum)
+            return 1;
+    }
+    return 0;
+}
+
+HOT_INLINE int positionIsNarrow(const Position *pos){
+    //the whole board fits in the low 64 bits of the masks
+    return pos->geometry != GEOMETRY_WIDE && pos->geometry != GEOMETRY_9X10_5;
+}
+
+Bitboard positionPlayableCells(const Position *pos){
+    //the cell each column would fill next, nothing for a full column
+    if (positionIsNarrow(pos)){
+        uint64_t narrow = 0;
+        for (int col = 0; col < pos->cols; col++){
+            if (pos->heights[col] < pos->rows)
+                narrow |= 1ULL << positionBitIndex(pos, pos->heights[col], col);
+        }
+        return narrow;
+    }
+    Bitboard cells = 0;
+    for (int col = 0; col < pos->cols; col++){
+        if (pos->heights[col] < pos->rows)
+            cells |= positionCellBit(pos, pos->heights[col], col);
+    }
+    return cells;
+}
+
+void positionWinningCells(const Position *pos, int sequenceNum, Bitboard cells[2]){
+    //for both players in one pass: the empty cells where a token would be inside a run of
+    //sequenceNum. bits outside the board mean nothing, so callers mask with playable cells.
+    threadCounters.winChecks++;
+    switch (pos->geometry){
+    case GEOMETRY_6X7_4:
+        if (sequenceNum == 4){
+            winningCellsNarrow((uint64_t)pos->tokens[0], (uint64_t)pos->tokens[1], 6, 7, 4, cells);
+            return;
+        }
+        winningCellsNarrow((uint64_t)pos->tokens[0], (uint64_t)pos->tokens[1], 6, 7, sequenceNum, cells);
+        return;
+    case GEOMETRY_7X8_4:
+        if (sequenceNum == 4){
+            winningCellsNarrow((uint64_t)pos->tokens[0], (uint64_t)pos->tokens[1], 7, 8, 4, cells);
+            return;
+        }
+        winningCellsNarrow((uint64_t)pos->tokens[0], (uint64_t)pos->tokens[1], 7, 8, sequenceNum, cells);
+        return;
+    case GEOMETRY_NARROW:
+        winningCellsNarrow((uint64_t)pos->tokens[0], (uint64_t)pos->tokens[1], pos->rows, pos->cols, sequenceNum, cells);
+        return;
+    default:
+        winningCellsWide(pos->tokens[0], pos->tokens[1], pos->rows, pos->cols, sequenceNum, cells);
+        return;
+    }
+}
+
+HOT_INLINE void winningCellsNarrow(uint64_t tokens0, uint64_t tokens1, int rows, int cols, int sequenceNum, Bitboard cells[2]){
+    //per line, a cell completes a run if i tokens follow it and sequenceNum - 1 - i precede it
+    //for some i: after holds the cells followed by i tokens, before[j] those preceded by j.
+    //a line shorter than sequenceNum is skipped, which also keeps every shift inside 64 bits.
+    const int shifts[4] = {1, rows + 1, rows, rows + 2};
+    const int lengths[4] = {rows, cols, rows < cols ? rows : cols, rows < cols ? rows : cols};
+    const uint64_t tokens[2] = {tokens0, tokens1};
+    for (int player = 0; player < 2; player++){
+        uint64_t found = 0;
+        for (int dir = 0; sequenceNum >= 2 && dir < 4; dir++){
+            if (sequenceNum > lengths[dir])
+                continue;
+            uint64_t before[MAX_COLS];
+            before[0] = ~0ULL;
+            for (int j = 1; j < sequenceNum; j++)
+                before[j] = before[j - 1] & (tokens[player] << (j * shifts[dir]));
+            uint64_t after = ~0ULL;
+            found |= before[sequenceNum - 1];
+            for (int i = 1; i < sequenceNum; i++){
+                after &= tokens[player] >> (i * shifts[dir]);
+                found |= after & before[sequenceNum - 1 - i];
+            }
+        }
+        cells[player] = found & ~(tokens0 | tokens1);
+    }
+}
+
+HOT_INLINE void winningCellsWide(Bitboard tokens0, Bitboard tokens1, int rows, int cols, int sequenceNum, Bitboard cells[2]){
+    //winningCellsNarrow on the full Bitboard
+    const int shifts[4] = {1, rows + 1, rows, rows + 2};
+    const int lengths[4] = {rows, cols, rows < cols ? rows : cols, rows < cols ? rows : cols};
+    const Bitboard tokens[2] = {tokens0, tokens1};
+    for (int player = 0; player < 2; player++){
+        Bitboard found = 0;
+        for (int dir = 0; sequenceNum >= 2 && dir < 4; dir++){
+            if (sequenceNum > lengths[dir])
+                continue;
+            Bitboard before[MAX_COLS];
+            before[0] = ~(Bitboard)0;
+            for (int j = 1; j < sequenceNum; j++)
+                before[j] = before[j - 1] & (tokens[player] << (j * shifts[dir]));
+            Bitboard after = ~(Bitboard)0;
+            found |= before[sequenceNum - 1];
+            for (int i = 1; i < sequenceNum; i++){
+                after &= tokens[player] >> (i * shifts[dir]);
+                found |= after & before[sequenceNum - 1 - i];
+            }
+        }
+        cells[player] = found & ~(tokens0 | tokens1);
+    }
+}
+
+uint64_t zobristKey(int player, int bitIndex){
+    //a fixed random looking key for every cell, see ZOBRIST_KEY
+    return zobristKeys[player][bitIndex];
+}
+
+uint64_t positionCanonicalKey(const Position *pos, int *mirrored){
+    //the lesser key of the position and its mirror, so both share one entry.
+    //*mirrored tells whether moves must be mirrored to match the canonical side.
+    *mirrored = pos->mirrorHash < pos->hash;
+    return *mirrored ? pos->mirrorHash : pos->hash;
+}
+
+int positionIsSymmetric(const Position *pos){
+    return pos->hash == pos->mirrorHash;
+}
+
+int ttInit(TranspositionTable *tt, long long sizeMb){
+    //allocates the largest power of two bucket count that fits in sizeMb
+    //returns 0 if the memory could not be allocated, the table is then disabled
+    tt->buckets = NULL;
+    tt->bucketMask = 0;
+    tt->generation = 0;
+    if (sizeMb <= 0)
+        return 1;
+
+    uint64_t bucketCount = 1;
+    while (bucketCount * 2 * sizeof(TranspositionBucket) <= (uint64_t)sizeMb * 1024 * 1024)
+        bucketCount *= 2;
+
+    tt->buckets = aligned_alloc(64, bucketCount * sizeof(TranspositionBucket));
+    if (tt->buckets == NULL)
+        return 0;
+    memset(tt->buckets, 0, bucketCount * sizeof(TranspositionBucket));
+    tt->bucketMask = bucketCount - 1;
+    return 1;
+}
+
+void ttFree(TranspositionTable *tt){
+    free(tt->buckets);
+    tt->buckets = NULL;
+    tt->bucketMask = 0;
+}
+
+void ttClear(TranspositionTable *tt){
+    //empties the table for the next game: a new generation hides every stored entry,
+    //the memory itself is only wiped when the generations run out
+    if (tt->buckets == NULL)
+        return;
+    tt->generation++;
+    if (tt->generation == TT_GENERATIONS){
+        memset(tt->buckets, 0, (tt->bucketMask + 1) * sizeof(TranspositionBucket));
+        tt->generation = 0;
+    }
+}
+
+uint64_t ttPack(int score, int depth, int bound, int move){
+    return (uint64_t)(uint16_t)score | (uint64_t)(uint8_t)depth << 16
+         | (uint64_t)(uint8_t)bound << 24 | (uint64_t)(uint8_t)move << 32;
+}
+
+void ttUnpack(uint64_t key, uint64_t data, TranspositionEntry *entry){
+    entry->key = key;
+    entry->score = (int16_t)(uint16_t)data;
+    entry->depth = (int8_t)(uint8_t)(data >> 16);
+    entry->bound = (uint8_t)(data >> 24);
+    entry->move = (int8_t)(uint8_t)(data >> 32);
+}
+
+int ttProbe(const TranspositionTable *tt, uint64_t key, TranspositionEntry *entry){
+    //copies the entry stored for key, returns 0 if there is none
+    if (tt->buckets == NULL)
+        return 0;
+
+    TranspositionSlot *slots = tt->buckets[key & tt->bucketMask].slots;
+    for (int i = 0; i < TT_BUCKET_SIZE; i++){
+        uint64_t data = atomic_load_explicit(&slots[i].data, memory_order_relaxed);
+        uint64_t check = atomic_load_explicit(&slots[i].check, memory_order_relaxed);
+        if (data && data >> TT_GENERATION_SHIFT == tt->generation && (check ^ data) == key){
+            ttUnpack(key, data, entry);
+            threadCounters.ttHits++;
+            return 1;
+        }
+    }
+    threadCounters.ttMisses++;
+    return 0;
+}
+
+void ttStore(TranspositionTable *tt, uint64_t key, int score, int depth, int bound, int move){
+    if (tt->buckets == NULL)
+        return;
+
+    TranspositionSlot *slots = tt->buckets[key & tt->bucketMask].slots;
+    TranspositionEntry current[2];
+    for (int i = 0; i < 2; i++){
+        uint64_t data = atomic_load_explicit(&slots[i].data, memory_order_relaxed);
+        uint64_t check = atomic_load_explicit(&slots[i].check, memory_order_relaxed);
+        if (data >> TT_GENERATION_SHIFT != tt->generation)
+            data = 0;  //left over from an earlier generation, free
+        ttUnpack(check ^ data, data, &current[i]);
+    }
+
+    //depth-preferred half: refresh our own entry or take the shallower one, if we are at least as deep
+    int index = current[0].depth <= current[1].depth ? 0 : 1;
+    if (current[0].bound && current[0].key == key)
+        index = 0;
+    else if (current[1].bound && current[1].key == key)
+        index = 1;
+
+    //always-replace half: the key picks the slot, so a position never sits in both
+    if (current[index].bound && depth < current[index].depth)
+        index = 2 + (int)(key >> 63);
+
+    uint64_t data = ttPack(score, depth, bound, move) | tt->generation << TT_GENERATION_SHIFT;
+    atomic_store_explicit(&slots[index].check, key ^ data, memory_order_relaxed);
+    atomic_store_explicit(&slots[index].data, data, memory_order_relaxed);
+}
+
+int scoreToTable(int score, int ply){
+    //wins are stored relative to the node instead of the root, so they stay valid at any ply
+    if (score >= DECISIVE_SCORE)
+        return score + ply;
+    if (score <= -DECISIVE_SCORE)
+        return score - ply;
+    return score;
+}
+
+int scoreFromTable(int score, int ply){
+    if (score >= DECISIVE_SCORE)
+        return score - ply;
+    if (score <= -DECISIVE_SCORE)
+        return score + ply;
+    return score;
+}
+
+int checkPlayerForPossibleSequence(char board [][MAX_COLS], int rows, int cols, char playerToken, int sequenceNum, int indexMap[MAX_COLS]){
+    //in each column we will insert the next move, 
+    //and for each updated position we will check wether the player has a sequence of sequenceNum.
+    //if he has the sequence return the move that created the sequence
+    //else return -1, no move will create a sequence of sequenceNum
+    //the grid is loaded on every call, findPositionSequenceMove skips that
+    Position pos;
+    positionLoad(&pos, board, rows, cols, CONNECT_N);
+    return findPositionSequenceMove(&pos, playerIndex(playerToken), sequenceNum, indexMap);
+}
+
+int findPositionSequenceMove(const Position *pos, int player, int sequenceNum, const int indexMap[MAX_COLS]){
+    //the probe token only goes into a copy of the player's mask, the position is never touched
+    for (int col = 0; col < pos->cols; col++){
+        int colToCheckFirst = indexMap[col];
+        if (!positionCanPlay(pos, colToCheckFirst)){
+            //sequence is not possible at this column
+            continue;
+        }
+
+        if (positionCellInSequence(pos, player, pos->heights[colToCheckFirst], colToCheckFirst, sequenceNum)){
+            return colToCheckFirst;
+        }
+    }
+    return -1;
+}
+
+int firstColumnIn(const Position *pos, Bitboard cells, const int indexMap[MAX_COLS]){
+    //the first column in indexMap order whose next cell is in cells, -1 if there is none
+    for (int i = 0; i < pos->cols; i++){
+        int col = indexMap[i];
+        if (positionCanPlay(pos, col) && (cells & positionCellBit(pos, pos->heights[col], col)))
+            return col;
+    }
+    return -1;
+}
+
+int generateComputerPlayerMove(char board [][MAX_COLS], int rows, int cols, char playerToken, char opposingPlayerToken, int whatColsToCheckFirst[MAX_COLS]){
+
+    //WE ASSUME THE BOARD IS NOT FULL WHEN USING THIS FUNCTION!!!!
+    //the opposing token is always the other bitboard, so only ours is needed.
+    //the grid is loaded on every call, generatePositionMove skips that
+    (void)opposingPlayerToken;
+    Position pos;
+    positionLoad(&pos, board, rows, cols, CONNECT_N);
+    return generatePositionMove(&pos, playerIndex(playerToken), CONNECT_N, whatColsToCheckFirst);
+}
+
+int generatePositionMove(const Position *pos, int player, int connectN, const int indexMap[MAX_COLS]){
+
+    // Priority order
+    // 1. Winning move - if it is possible to win on the next move - choose the column that produces the win.
+    // 2. Blocking the opponent - if the opponent can win on their next move choose the column that prevents this.
+    // 3. Creating a sequence of three - if it is possible to create a sequence of three tokens do so.
+    // 4. Blocking the opponent’s sequence of three.
+    // 5. Choosing according to the arbitrary ordering rule.
+
+    // Ordering rule for columns
     // When several options have the same priority level, choose a column according to the following rules:
     // 1. Prefer the column whose distance from the center column is minimal.
     // 2. If the distance is equal, choose the left column among the two.
+    const int opponent = 1 - player;
+
+    //both players' cells for a sequence come out of one pass over the board
+    Bitboard cells[2];
+    positionWinningCells(pos, connectN, cells);
+
+    //1. if it is possible to win on the next move - choose the column that produces the win.
+    int winningMove = firstColumnIn(pos, cells[player], indexMap);
+    if (winningMove != -1){
+        return winningMove;
+    }
+    //2. if the opponent can win on their next move choose the column that prevents this.
+    int opponentWinningMove = firstColumnIn(pos, cells[opponent], indexMap);
+    if (opponentWinningMove != -1){
+        return opponentWinningMove;
+    }
+
+    //3. if it is possible to create a sequence of three tokens do so.
+    //   (one short of connectN on other board sizes)
+    positionWinningCells(pos, connectN - 1, cells);
+    int moveForASequenceOf3 = firstColumnIn(pos, cells[player], indexMap);
+    if (moveForASequenceOf3 != -1){
+        return moveForASequenceOf3;
+    }
+
+    //4. Blocking the opponent’s sequence of three
+    int OpponentmoveForASequenceOf3 = firstColumnIn(pos, cells[opponent], indexMap);
+    if (OpponentmoveForASequenceOf3 != -1){
+        return OpponentmoveForASequenceOf3;
+    }
+
+    //5. the first column in center-first order that still has room
+    for (int i = 0; i < pos->cols; i++){
+        int column = indexMap[i];
+        if (positionCanPlay(pos, column)){
+            return column;
+        }
+    }
+
+    //never gets here but the compiler cries...
+
+    return -1;
+}
+
+void defaultEngineOptions(EngineOptions *options){
+    options->aiMode = AI_RULE;
+    options->maxDepth = DEFAULT_SEARCH_DEPTH;
+    options->timeLimitMs = 0;
+    options->nodeLimit = 0;
+    options->ttSizeMb = DEFAULT_TT_MB;
+    options->searchThreads = 1;
+    options->evaluation = EVAL_THREATS;
+    options->bookPath = NULL;
+    options->book = NULL;
+    options->endgamePath = NULL;
+    options->endgame = NULL;
+    options->showStats = 0;
+    options->ponder = 0;
+    options->renderMode = RENDER_FULL;
+}
+
+int parseEngineOption(EngineOptions *options, const char *arg){
+    //applies a single --key=value command line option
+    //returns 1 if the option was recognized and valid, 0 otherwise
+    if (strcmp(arg, "--ai=rule") == 0){
+        options->aiMode = AI_RULE;
+        return 1;
+    }
+    if (strcmp(arg, "--ai=search") == 0){
+        options->aiMode = AI_SEARCH;
+        return 1;
+    }
+    if (strcmp(arg, "--ai=max") == 0){
+        options->aiMode = AI_MAX;
+        return 1;
+    }
+    if (strcmp(arg, "--ai=mcts") == 0){
+        options->aiMode = AI_MCTS;
+        return 1;
+    }
+    if (strncmp(arg, "--depth=", 8) == 0){
+        options->maxDepth = atoi(arg + 8);
+        return options->maxDepth > 0;
+    }
+    if (strncmp(arg, "--time-ms=", 10) == 0){
+        options->timeLimitMs = atoll(arg + 10);
+        return options->timeLimitMs >= 0;
+    }
+    if (strncmp(arg, "--nodes=", 8) == 0){
+        options->nodeLimit = atoll(arg + 8);
+        return options->nodeLimit >= 0;
+    }
+    if (strncmp(arg, "--tt-mb=", 8) == 0){
+        options->ttSizeMb = atoll(arg + 8);
+        return options->ttSizeMb >= 0;
+    }
+    if (strncmp(arg, "--book=", 7) == 0){
+        options->bookPath = arg + 7;
+        return arg[7] != '\0';
+    }
+    if (strncmp(arg, "--endgame=", 10) == 0){
+        options->endgamePath = arg + 10;
+        return arg[10] != '\0';
+    }
+    if (strcmp(arg, "--stats") == 0){
+        options->showStats = 1;
+        return 1;
+    }
+    if (strcmp(arg, "--ponder") == 0){
+        options->ponder = 1;
+        return 1;
+    }
+    if (strncmp(arg, "--render=", 9) == 0){
+        static const char *const modes[] = {"full", "compact", "diff", "quiet"};
+        for (int mode = RENDER_FULL; mode <= RENDER_QUIET; mode++){
+            if (strcmp(arg + 9, modes[mode]) == 0){
+                options->renderMode = mode;
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (strcmp(arg, "--eval=center") == 0){
+        options->evaluation = EVAL_CENTER;
+        return 1;
+    }
+    if (strcmp(arg, "--eval=threats") == 0){
+        options->evaluation = EVAL_THREATS;
+        return 1;
+    }
+    if (strncmp(arg, "--search-threads=", 17) == 0){
+        options->searchThreads = atoi(arg + 17);
+        return options->searchThreads > 0 && options->searchThreads <= MAX_SEARCH_THREADS;
+    }
+    return 0;
+}
+
+void searchContextInit(SearchContext *ctx, const EngineOptions *options, int cols, int connectN){
+    ctx->options = *options;
+    ctx->connectN = connectN;
+    setIndexMap(ctx->order, cols);
+    ctx->nodes = 0;
+    ctx->deadline = 0;
+    ctx->stopped = 0;
+    ctx->stopSignal = NULL;
+    ctx->readyMove = -1;
+
+    //only the search and the solver use the table; without memory they simply search uncached.
+    //the tree search spends the memory on its tree instead, without one it plays the rules.
+    ttInit(&ctx->tt, options->aiMode != AI_RULE && options->aiMode != AI_MCTS ? options->ttSizeMb : 0);
+    ctx->mcts = options->aiMode == AI_MCTS ? mctsCreate(options->ttSizeMb) : NULL;
+}
+
+void searchContextFree(SearchContext *ctx){
+    ttFree(&ctx->tt);
+    mctsFree(ctx->mcts);
+}
+
+void searchContextReset(SearchContext *ctx){
+    //forgets everything learned in earlier games, so that the next game plays exactly as
+    //with a freshly initialized context
+    ttClear(&ctx->tt);
+    if (ctx->mcts != NULL)
+        ctx->mcts->valid = 0;
+    ctx->readyMove = -1;
+}
+
+int orderMoves(const Position *pos, const SearchContext *ctx, int firstMove, int moves[MAX_COLS]){
+    //playable columns in setIndexMap order, with firstMove (best move from the table or
+    //the previous iteration, -1 for none) tried first. returns the number of moves.
+    int count = 0;
+    if (firstMove != -1 && positionCanPlay(pos, firstMove))
+        moves[count++] = firstMove;
+    for (int i = 0; i < pos->cols; i++){
+        int col = ctx->order[i];
+        if (col != firstMove && positionCanPlay(pos, col))
+            moves[count++] = col;
+    }
+    return count;
+}
+
+int generateMoves(const Position *pos, int player, const Bitboard wins[2], Bitboard playable, const int order[MAX_COLS], int moves[MAX_COLS]){
+    //the moves that do not lose on the spot, in order: if the opponent has a winning cell to
+    //play, only blocking it; never a cell right under one of its winning cells. wins comes from
+    //positionWinningCells and the caller has already taken any win of its own.
+    //returns 0 when every move loses.
+    if (positionIsNarrow(pos))
+        return generateMovesNarrow(pos, (uint64_t)wins[1 - player], (uint64_t)playable, order, moves);
+    return generateMovesWide(pos, wins[1 - player], playable, order, moves);
+}
+
+HOT_INLINE int generateMovesNarrow(const Position *pos, uint64_t opponentWins, uint64_t playable, const int order[MAX_COLS], int moves[MAX_COLS]){
+    const uint64_t threats = opponentWins & playable;
+    if (threats & (threats - 1))
+        return 0;  //two or more
+
+    int count = 0;
+    for (int i = 0; i < pos->cols; i++){
+        int col = order[i];
+        if (!positionCanPlay(pos, col))
+            continue;
+        uint64_t cell = 1ULL << positionBitIndex(pos, pos->heights[col], col);
+        if (threats && !(threats & cell))
+            continue;
+        if (pos->heights[col] + 1 < pos->rows && (opponentWins & (cell << 1)))
+            continue;
+        moves[count++] = col;
+    }
+    return count;
+}
+
+HOT_INLINE int generateMovesWide(const Position *pos, Bitboard opponentWins, Bitboard playable, const int order[MAX_COLS], int moves[MAX_COLS]){
+    //generateMovesNarrow on the full Bitboard
+    const Bitboard threats = opponentWins & playable;
+    if (threats & (threats - 1))
+        return 0;
+
+    int count = 0;
+    for (int i = 0; i < pos->cols; i++){
+        int col = order[i];
+        if (!positionCanPlay(pos, col))
+            continue;
+        Bitboard cell = positionCellBit(pos, pos->heights[col], col);
+        if (threats && !(threats & cell))
+            continue;
+        if (pos->heights[col] + 1 < pos->rows && (opponentWins & (cell << 1)))
+            continue;
+        moves[count++] = col;
+    }
+    return count;
+}
+
+void promoteMove(int moves[MAX_COLS], int count, int move){
+    //moves move to the front, keeping the order of the others
+    for (int i = 1; i < count; i++){
+        if (moves[i] == move){
+            memmove(&moves[1], &moves[0], (size_t)i * sizeof(int));
+            moves[0] = move;
+            return;
+        }
+    }
+}
+
+long long monotonicNanos(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+int bitboardCount(Bitboard b){
+    //popcount in 64-bit slices; the double shift stays defined for a 64-bit Bitboard
+    int count = 0;
+    while (b){
+        count += __builtin_popcountll((unsigned long long)b);
+        b >>= 32;
+        b >>= 32;
+    }
+    return count;
+}
+
+int bitboardLowestIndex(Bitboard b){
+    //index of the lowest set bit, b must not be 0
+    uint64_t low = (uint64_t)b;
+    if (low)
+        return __builtin_ctzll(low);
+    b >>= 32;
+    b >>= 32;
+    return 64 + __builtin_ctzll((uint64_t)b);
+}
+
+int centerWeight(int col, int cols){
+    //cols for the center column, down to 1 or 2 for the edges
+    int distance = 2 * col - (cols - 1);
+    return cols - (distance < 0 ? -distance : distance);
+}
+
+int threatWindowScore(Bitboard tokens0, Bitboard tokens1, Bitboard window, int rows, int connectN){
+    //score for player 0 of one window of connectN cells. a window that holds both players
+    //can never be completed and is worth nothing. one token short of a sequence it is a threat:
+    //player 0 wants its threats on odd rows counted from the bottom, player 1 on even rows.
+    int count0 = bitboardCount(tokens0 & window);
+    int count1 = bitboardCount(tokens1 & window);
+    if (count0 && count1)
+        return 0;
+    int count = count0 + count1;
+    if (count == 0 || count >= connectN)
+        return 0;
+
+    int owner = count0 ? 0 : 1;
+    int score = count * count;
+    if (count == connectN - 1){
+        int row = bitboardLowestIndex(window & ~(tokens0 | tokens1)) % (rows + 1);
+        score = THREAT_SCORE + ((row & 1) == owner ? PARITY_BONUS : 0);
+    }
+    return owner == 0 ? score : -score;
+}
+
+HOT_INLINE int threatWindowScoreNarrow(uint64_t tokens0, uint64_t tokens1, uint64_t window, int rows, int connectN){
+    //threatWindowScore on 64 bits
+    int count0 = __builtin_popcountll(tokens0 & window);
+    int count1 = __builtin_popcountll(tokens1 & window);
+    if (count0 && count1)
+        return 0;
+    int count = count0 + count1;
+    if (count == 0 || count >= connectN)
+        return 0;
+
+    int owner = count0 ? 0 : 1;
+    int score = count * count;
+    if (count == connectN - 1){
+        int row = __builtin_ctzll(window & ~(tokens0 | tokens1)) % (rows + 1);
+        score = THREAT_SCORE + ((row & 1) == owner ? PARITY_BONUS : 0);
+    }
+    return owner == 0 ? score : -score;
+}
+
+int evaluatePosition(const Position *pos, int player, int evaluation){
+    //static score of a quiet position from the point of view of player, rescanning the
+    //whole board. the search keeps the same score up to date with moveScoreDelta instead.
+    const Bitboard columnMask = ((Bitboard)1 << pos->rows) - 1;
+    int score = 0;
+    for (int col = 0; col < pos->cols; col++){
+        Bitboard cells = columnMask << (col * (pos->rows + 1));
+        score += centerWeight(col, pos->cols) * (bitboardCount(pos->tokens[0] & cells) - bitboardCount(pos->tokens[1] & cells));
+    }
+
+    if (evaluation == EVAL_THREATS){
+        //every window of connectN cells: vertical, horizontal and both diagonals
+        const int rowSteps[4] = {1, 0, 1, -1};
+        const int colSteps[4] = {0, 1, 1, 1};
+        for (int dir = 0; dir < 4; dir++){
+            int shift = colSteps[dir] * (pos->rows + 1) + rowSteps[dir];
+            Bitboard pattern = 0;
+            for (int i = 0; i < pos->connectN; i++)
+                pattern |= (Bitboard)1 << (i * shift);
+            for (int row = 0; row < pos->rows; row++){
+                for (int col = 0; col < pos->cols; col++){
+                    int endRow = row + (pos->connectN - 1) * rowSteps[dir];
+                    int endCol = col + (pos->connectN - 1) * colSteps[dir];
+                    if (!isInBounds(endRow, endCol, pos->rows, pos->cols))
+                        continue;
+                    Bitboard window = pattern << positionBitIndex(pos, row, col);
+                    score += threatWindowScore(pos->tokens[0], pos->tokens[1], window, pos->rows, pos->connectN);
+                }
+            }
+        }
+    }
+    return player == 0 ? score : -score;
+}
+
+int moveScoreDelta(const Position *pos, int player, int col, int evaluation){
+    //how much the player 0 score of evaluatePosition changes when player plays col.
+    //only the windows through the new token can change, so only those are scored.
+    int center = centerWeight(col, pos->cols);
+    int delta = player == 0 ? center : -center;
+    if (evaluation != EVAL_THREATS)
+        return delta;
+    if (positionIsNarrow(pos))
+        return delta + threatDeltaNarrow(pos, player, col);
+    return delta + threatDeltaWide(pos, player, col);
+}
+
+HOT_INLINE int threatDeltaNarrow(const Position *pos, int player, int col){
+    //the threat windows through the new token, scored after and before the move
+    int delta = 0;
+    int row = pos->heights[col];
+    uint64_t before[2] = {(uint64_t)pos->tokens[0], (uint64_t)pos->tokens[1]};
+    uint64_t after[2] = {before[0], before[1]};
+    after[player] |= 1ULL << positionBitIndex(pos, row, col);
+
+    const int rowSteps[4] = {1, 0, 1, -1};
+    const int colSteps[4] = {0, 1, 1, 1};
+    for (int dir = 0; dir < 4; dir++){
+        int shift = colSteps[dir] * (pos->rows + 1) + rowSteps[dir];
+        uint64_t pattern = 0;
+        for (int i = 0; i < pos->connectN; i++)
+            pattern |= 1ULL << (i * shift);
+        //the token is the k-th cell of the window
+        for (int k = 0; k < pos->connectN; k++){
+            int startRow = row - k * rowSteps[dir];
+            int startCol = col - k * colSteps[dir];
+            int endRow = startRow + (pos->connectN - 1) * rowSteps[dir];
+            int endCol = startCol + (pos->connectN - 1) * colSteps[dir];
+            if (!isInBounds(startRow, startCol, pos->rows, pos->cols) || !isInBounds(endRow, endCol, pos->rows, pos->cols))
+                continue;
+            uint64_t window = pattern << positionBitIndex(pos, startRow, startCol);
+            delta += threatWindowScoreNarrow(after[0], after[1], window, pos->rows, pos->connectN)
+                   - threatWindowScoreNarrow(before[0], before[1], window, pos->rows, pos->connectN);
+        }
+    }
+    return delta;
+}
+
+HOT_INLINE int threatDeltaWide(const Position *pos, int player, int col){
+    //threatDeltaNarrow on the full Bitboard
+    int delta = 0;
+    int row = pos->heights[col];
+    Bitboard after[2] = {pos->tokens[0], pos->tokens[1]};
+    after[player] |= positionCellBit(pos, row, col);
+
+    const int rowSteps[4] = {1, 0, 1, -1};
+    const int colSteps[4] = {0, 1, 1, 1};
+    for (int dir = 0; dir < 4; dir++){
+        int shift = colSteps[dir] * (pos->rows + 1) + rowSteps[dir];
+        Bitboard pattern = 0;
+        for (int i = 0; i < pos->connectN; i++)
+            pattern |= (Bitboard)1 << (i * shift);
+        //the token is the k-th cell of the window
+        for (int k = 0; k < pos->connectN; k++){
+            int startRow = row - k * rowSteps[dir];
+            int startCol = col - k * colSteps[dir];
+            int endRow = startRow + (pos->connectN - 1) * rowSteps[dir];
+            int endCol = startCol + (pos->connectN - 1) * colSteps[dir];
+            if (!isInBounds(startRow, startCol, pos->rows, pos->cols) || !isInBounds(endRow, endCol, pos->rows, pos->cols))
+                continue;
+            Bitboard window = pattern << positionBitIndex(pos, startRow, startCol);
+            delta += threatWindowScore(after[0], after[1], window, pos->rows, pos->connectN)
+                   - threatWindowScore(pos->tokens[0], pos->tokens[1], window, pos->rows, pos->connectN);
+        }
+    }
+    return delta;
+}
+
+int isWinningMove(const Position *pos, int player, int col, int connectN){
+    //we assume the column is playable; the token is only added to a copy of the mask
+    return positionCellInSequence(pos, player, pos->heights[col], col, connectN);
+}
+
+int searchBudgetExceeded(SearchContext *ctx){
+    if (ctx->stopSignal && atomic_load_explicit(ctx->stopSignal, memory_order_relaxed))
+        return 1;
+    if (ctx->options.nodeLimit && ctx->nodes >= ctx->options.nodeLimit)
+        return 1;
+    //reading the clock is far more expensive than a node, so only look every 1024 nodes
+    if (ctx->deadline && (ctx->nodes & 1023) == 0 && monotonicNanos() >= ctx->deadline)
+        return 1;
+    return 0;
+}
+
+int negamax(Position *pos, int player, int depth, int alpha, int beta, int ply, int score, SearchContext *ctx){
+    //returns the score of the position for player, the side to move.
+    //score is the static evaluation for player 0, updated move by move by the caller.
+    ctx->nodes++;
+    threadCounters.nodes++;
+    if (searchBudgetExceeded(ctx)){
+        ctx->stopped = 1;
+        return 0;
+    }
+
+    //a win on the spot ends the line, nothing deeper can beat it
+    Bitboard wins[2];
+    positionWinningCells(pos, ctx->connectN, wins);
+    Bitboard playable = positionPlayableCells(pos);
+    if (wins[player] & playable)
+        return WIN_SCORE - ply - 1;
+    if (positionIsFull(pos))
+        return 0;
+
+    //with two threats to block, or only moves under the opponent's winning cells, it wins next
+    int moves[MAX_COLS];
+    int count = generateMoves(pos, player, wins, playable, ctx->order, moves);
+    if (count == 0)
+        return -(WIN_SCORE - ply - 2);
+    int endgameScore;
+    if (ctx->options.endgame != NULL && endgameProbe(ctx->options.endgame, pos, &endgameScore) != -1)
+        return scoreFromTable(endgameScore, ply);
+    if (depth == 0)
+        return player == 0 ? score : -score;
+
+    const int alphaOrig = alpha;
+    int ttMove = -1;
+    int mirrored;
+    uint64_t key = positionCanonicalKey(pos, &mirrored);
+    TranspositionEntry entry;
+    if (ttProbe(&ctx->tt, key, &entry)){
+        ttMove = mirrored ? pos->cols - 1 - entry.move : entry.move;
+        if (entry.depth >= depth){
+            int ttScore = scoreFromTable(entry.score, ply);
+            if (entry.bound == BOUND_EXACT
+                || (entry.bound == BOUND_LOWER && ttScore >= beta)
+                || (entry.bound == BOUND_UPPER && ttScore <= alpha)){
+                threadCounters.cutoffs++;
+                return ttScore;
+            }
+        }
+    }
+
+    promoteMove(moves, count, ttMove);
+    int best = -INF_SCORE;
+    int bestMove = moves[0];
+    for (int i = 0; i < count; i++){
+        int childScore = score + moveScoreDelta(pos, player, moves[i], ctx->options.evaluation);
+        positionPlay(pos, player, moves[i]);
+        int value = -negamax(pos, 1 - player, depth - 1, -beta, -alpha, ply + 1, childScore, ctx);
+        positionUndo(pos, moves[i]);
+        if (ctx->stopped)
+            return 0;
+
+        if (value > best){
+            best = value;
+            bestMove = moves[i];
+        }
+        if (value > alpha)
+            alpha = value;
+        if (alpha >= beta){
+            threadCounters.cutoffs++;
+            break;
+        }
+    }
+
+    int bound = best <= alphaOrig ? BOUND_UPPER : (best >= beta ? BOUND_LOWER : BOUND_EXACT);
+    ttStore(&ctx->tt, key, scoreToTable(best, ply), depth, bound, mirrored ? pos->cols - 1 - bestMove : bestMove);
+    return best;
+}
+
+int searchRoot(Position *pos, int player, int depth, int pvMove, SearchContext *ctx, int *bestMove){
+    //one iteration of the iterative deepening, trying the previous best move first
+    if (positionIsFull(pos)){
+        //nothing to search
+        *bestMove = -1;
+        return 0;
+    }
+
+    Bitboard wins[2];
+    positionWinningCells(pos, ctx->connectN, wins);
+    Bitboard playable = positionPlayableCells(pos);
+    if (wins[player] & playable){
+        *bestMove = firstColumnIn(pos, wins[player], ctx->order);
+        return WIN_SCORE - 1;
+    }
+
+    int moves[MAX_COLS];
+    int count = generateMoves(pos, player, wins, playable, ctx->order, moves);
+    if (count == 0){
+        //every move loses next turn, any of them will do
+        *bestMove = firstColumnIn(pos, playable, ctx->order);
+        return -(WIN_SCORE - 2);
+    }
+    promoteMove(moves, count, pvMove);
+
+    //on a symmetric board a move and its mirror score the same, so only one of each pair is searched
+    if (positionIsSymmetric(pos)){
+        int kept = 0;
+        for (int i = 0; i < count; i++){
+            if (moves[i] <= pos->cols - 1 - moves[i])
+                moves[kept++] = moves[i];
+        }
+        count = kept;
+    }
+
+    int alpha = -INF_SCORE;
+    int rootScore = evaluatePosition(pos, 0, ctx->options.evaluation);
+    *bestMove = moves[0];
+    for (int i = 0; i < count; i++){
+        int childScore = rootScore + moveScoreDelta(pos, player, moves[i], ctx->options.evaluation);
+        positionPlay(pos, player, moves[i]);
+        int score = -negamax(pos, 1 - player, depth - 1, -INF_SCORE, -alpha, 1, childScore, ctx);
+        positionUndo(pos, moves[i]);
+        if (ctx->stopped)
+            return 0;
+
+        if (score > alpha){
+            alpha = score;
+            *bestMove = moves[i];
+        }
+    }
+    return alpha;
+}
+
+void *searchHelperWorker(void *arg){
+    //the main thread's iterative deepening without a result: whatever the helper
+    //finds reaches the main thread through the shared table
+    SearchHelper *helper = arg;
+    SearchContext *ctx = &helper->ctx;
+    int emptyCells = helper->pos.rows * helper->pos.cols - helper->pos.moveCount;
+
+    int pvMove = -1;
+    for (int depth = helper->firstDepth; depth <= ctx->options.maxDepth && depth <= emptyCells; depth++){
+        int move;
+        int score = searchRoot(&helper->pos, helper->player, depth, pvMove, ctx, &move);
+        if (ctx->stopped || score >= DECISIVE_SCORE || score <= -DECISIVE_SCORE)
+            break;
+        pvMove = move;
+    }
+    countersFlush();
+    return NULL;
+}
+
+int startSearchHelpers(const Position *pos, int player, const SearchContext *ctx, atomic_int *stopSignal, SearchHelper helpers[]){
+    //starts searchThreads - 1 helpers (lazy SMP) and returns how many are running.
+    //without a table the helpers could not pass anything on, so none are started.
+    if (ctx->options.searchThreads <= 1 || ctx->tt.buckets == NULL)
+        return 0;
+
+    atomic_init(stopSignal, 0);
+    int count = 0;
+    for (; count < ctx->options.searchThreads - 1; count++){
+        SearchHelper *helper = &helpers[count];
+        helper->pos = *pos;
+        helper->ctx = *ctx;
+        helper->ctx.options.nodeLimit = 0;  //the node budget counts the main thread only
+        helper->ctx.stopSignal = stopSignal;
+        helper->player = player;
+        helper->firstDepth = 1 + (count & 1);
+        if (pthread_create(&helper->thread, NULL, searchHelperWorker, helper) != 0)
+            break;
+    }
+    return count;
+}
+
+long long stopSearchHelpers(SearchHelper helpers[], int count, atomic_int *stopSignal){
+    //stops and joins the helpers, returns the nodes they searched
+    long long nodes = 0;
+    if (count > 0)
+        atomic_store(stopSignal, 1);
+    for (int i = 0; i < count; i++){
+        pthread_join(helpers[i].thread, NULL);
+        nodes += helpers[i].ctx.nodes;
+    }
+    return nodes;
+}
+
+SearchResult searchBestMove(Position *pos, int player, SearchContext *ctx){
+    //iterative deepening negamax with alpha-beta pruning.
+    //the rule based move is the answer until the first iteration completes.
+    SearchResult result;
+    result.move = generatePositionMove(pos, player, ctx->connectN, ctx->order);
+    result.score = 0;
+    result.depth = 0;
+
+    ctx->nodes = 0;
+    ctx->stopped = 0;
+    ctx->deadline = ctx->options.timeLimitMs ? monotonicNanos() + ctx->options.timeLimitMs * 1000000LL : 0;
+
+    int emptyCells = pos->rows * pos->cols - pos->moveCount;
+
+    atomic_int stopSignal;
+    SearchHelper helpers[MAX_SEARCH_THREADS - 1];
+    int helperCount = startSearchHelpers(pos, player, ctx, &stopSignal, helpers);
+
+    int pvMove = -1;
+    for (int depth = 1; depth <= ctx->options.maxDepth && depth <= emptyCells; depth++){
+        int move;
+        int score = searchRoot(pos, player, depth, pvMove, ctx, &move);
+        if (ctx->stopped)
+            break;
+
+        result.move = move;
+        result.score = score;
+        result.depth = depth;
+        pvMove = move;
+        //a forced win or loss is already proven, deeper iterations cannot change it
+        if (score >= DECISIVE_SCORE || score <= -DECISIVE_SCORE)
+            break;
+    }
+    ctx->nodes += stopSearchHelpers(helpers, helperCount, &stopSignal);
+    result.nodes = ctx->nodes;
+    return result;
+}
+
+int computerPlayerMove(Position *pos, int player, SearchContext *ctx){
+    //chooseComputerMove, counted. a rule move takes less time than reading the clock twice,
+    //so moves are only timed when the counters are going to be shown.
+    threadCounters.computerMoves++;
+    if (!ctx->options.showStats)
+        return chooseComputerMove(pos, player, ctx);
+
+    long long start = monotonicNanos();
+    int move = chooseComputerMove(pos, player, ctx);
+    long long nanos = monotonicNanos() - start;
+    threadCounters.moveNanos += nanos;
+    if (nanos > threadCounters.maxMoveNanos)
+        threadCounters.maxMoveNanos = nanos;
+    return move;
+}
+
+int chooseComputerMove(Position *pos, int player, SearchContext *ctx){
+    if (ctx->readyMove != -1){
+        //already searched while the opponent was thinking
+        int move = ctx->readyMove;
+        ctx->readyMove = -1;
+        return move;
+    }
+    if (ctx->options.endgame != NULL && ctx->options.aiMode != AI_RULE){
+        //late positions are solved already
+        int score;
+        int move = endgameProbe(ctx->options.endgame, pos, &score);
+        if (move != -1)
+            return move;
+    }
+    if (ctx->options.aiMode == AI_MAX){
+        //the book comes from a limited search, so it is only trusted once the solver gives up
+        long long timeLimitMs = ctx->options.timeLimitMs;
+        ctx->options.timeLimitMs = timeLimitMs ? timeLimitMs : DEFAULT_SOLVE_MS;
+        SearchResult result = solveBestMove(pos, player, 0, ctx);
+        ctx->options.timeLimitMs = timeLimitMs;
+        if (result.depth > 0)
+            return result.move;
+    }
+    if (ctx->options.book != NULL){
+        int score;
+        int move = bookProbe(ctx->options.book, pos, &score);
+        if (move != -1)
+            return move;
+    }
+    if (ctx->options.aiMode == AI_MCTS){
+        long long timeLimitMs = ctx->options.timeLimitMs;
+        if (timeLimitMs == 0 && ctx->options.nodeLimit == 0)
+            ctx->options.timeLimitMs = DEFAULT_MCTS_MS;
+        SearchResult result = mctsBestMove(pos, player, ctx);
+        ctx->options.timeLimitMs = timeLimitMs;
+        return result.move;
+    }
+    if (ctx->options.aiMode != AI_RULE)
+        return searchBestMove(pos, player, ctx).move;
+    return generatePositionMove(pos, player, ctx->connectN, ctx->order);
+}
+
+int orderSolverMoves(Position *pos, int player, int moves[MAX_COLS], int count, int connectN){
+    //sorts the moves by the number of winning cells they leave the player, keeping the
+    //setIndexMap order between equals. returns count.
+    Bitboard boardMask = 0;
+    Bitboard columnMask = ((Bitboard)1 << pos->rows) - 1;
+    for (int col = 0; col < pos->cols; col++)
+        boardMask |= columnMask << (col * (pos->rows + 1));
+
+    int threats[MAX_COLS];
+    for (int i = 0; i < count; i++){
+        Bitboard wins[2];
+        positionPlay(pos, player, moves[i]);
+        positionWinningCells(pos, connectN, wins);
+        Bitboard open = wins[player] & boardMask & ~pos->occupied;
+        threats[i] = positionIsNarrow(pos) ? __builtin_popcountll((uint64_t)open) : bitboardCount(open);
+        positionUndo(pos, moves[i]);
+    }
+    for (int i = 1; i < count; i++){
+        int move = moves[i], threat = threats[i];
+        int j = i;
+        for (; j > 0 && threats[j - 1] < threat; j--){
+            moves[j] = moves[j - 1];
+            threats[j] = threats[j - 1];
+        }
+        moves[j] = move;
+        threats[j] = threat;
+    }
+    return count;
+}
+
+int solveNegamax(Position *pos, int player, int alpha, int beta, int ply, SearchContext *ctx){
+    //negamax to the end of the game: 0 for a draw, WIN_SCORE - ply - 1 for a win on the spot,
+    //so a score tells the exact number of plies left. fail soft, meant for null windows.
+    ctx->nodes++;
+    threadCounters.nodes++;
+    if (searchBudgetExceeded(ctx)){
+        ctx->stopped = 1;
+        return 0;
+    }
+
+    Bitboard wins[2];
+    positionWinningCells(pos, ctx->connectN, wins);
+    Bitboard playable = positionPlayableCells(pos);
+    if (wins[player] & playable)
+        return WIN_SCORE - ply - 1;
+    if (positionIsFull(pos))
+        return 0;
+    int moves[MAX_COLS];
+    int count = generateMoves(pos, player, wins, playable, ctx->order, moves);
+    if (count == 0)
+        return -(WIN_SCORE - ply - 2);
+    int endgameScore;
+    if (ctx->options.endgame != NULL && endgameProbe(ctx->options.endgame, pos, &endgameScore) != -1)
+        return scoreFromTable(endgameScore, ply);
+
+    //no win this move and no loss next move bound the score before anything is searched
+    int maxScore = WIN_SCORE - ply - 3;
+    if (beta > maxScore){
+        beta = maxScore;
+        if (alpha >= beta)
+            return beta;
+    }
+    int minScore = -(WIN_SCORE - ply - 4);
+    if (alpha < minScore){
+        alpha = minScore;
+        if (alpha >= beta)
+            return alpha;
+    }
+
+    //a position is only ever stored fully solved, so its depth is the empty cells
+    const int alphaOrig = alpha;
+    int depth = pos->rows * pos->cols - pos->moveCount;
+    int ttMove = -1;
+    int mirrored;
+    uint64_t key = positionCanonicalKey(pos, &mirrored);
+    TranspositionEntry entry;
+    if (ttProbe(&ctx->tt, key, &entry)){
+        ttMove = mirrored ? pos->cols - 1 - entry.move : entry.move;
+        if (entry.depth >= depth){
+            int ttScore = scoreFromTable(entry.score, ply);
+            if (entry.bound == BOUND_LOWER && ttScore > alpha)
+                alpha = ttScore;
+            if (entry.bound == BOUND_UPPER && ttScore < beta)
+                beta = ttScore;
+            if (entry.bound == BOUND_EXACT || alpha >= beta){
+                threadCounters.cutoffs++;
+                return ttScore;
+            }
+        }
+    }
+
+    orderSolverMoves(pos, player, moves, count, ctx->connectN);
+    promoteMove(moves, count, ttMove);
+    int best = -INF_SCORE;
+    int bestMove = moves[0];
+    for (int i = 0; i < count; i++){
+        positionPlay(pos, player, moves[i]);
+        int value = -solveNegamax(pos, 1 - player, -beta, -alpha, ply + 1, ctx);
+        positionUndo(pos, moves[i]);
+        if (ctx->stopped)
+            return 0;
+
+        if (value > best){
+            best = value;
+            bestMove = moves[i];
+        }
+        if (value > alpha)
+            alpha = value;
+        if (alpha >= beta){
+            threadCounters.cutoffs++;
+            break;
+        }
+    }
+
+    int bound = best <= alphaOrig ? BOUND_UPPER : (best >= beta ? BOUND_LOWER : BOUND_EXACT);
+    ttStore(&ctx->tt, key, scoreToTable(best, ply), depth, bound, mirrored ? pos->cols - 1 - bestMove : bestMove);
+    return best;
+}
+
+int solvePosition(Position *pos, int player, int weak, SearchContext *ctx){
+    //MTD style driver: null window searches narrow the score down from both ends.
+    //the first window sits at 0 and settles win, draw or loss; weak stops there and
+    //returns 1, 0 or -1, strong goes on halving the range to the exact score.
+    int min = weak ? -1 : -(WIN_SCORE - 1);
+    int max = weak ? 1 : WIN_SCORE - 1;
+    while (min < max){
+        int med = min + (max - min) / 2;
+        if (min < 0 && max > 0)
+            med = 0;
+        else if (min < 0 && max == 0)
+            med = -1;
+        int value = solveNegamax(pos, player, med, med + 1, 0, ctx);
+        if (ctx->stopped)
+            return 0;
+        if (value <= med)
+            max = value;
+        else
+            min = value;
+    }
+    if (weak)
+        return min > 0 ? 1 : (min < 0 ? -1 : 0);
+    return min;
+}
+
+SearchResult solveBestMove(Position *pos, int player, int weak, SearchContext *ctx){
+    //solves the position, then picks a move that keeps its score: with strong the fastest win
+    //or the slowest loss, with weak any win or draw. depth is the empty cells when solved
+    //and 0 when the budget ran out first.
+    SearchResult result;
+    result.move = generatePositionMove(pos, player, ctx->connectN, ctx->order);
+    result.score = 0;
+    result.depth = 0;
+
+    ctx->nodes = 0;
+    ctx->stopped = 0;
+    ctx->deadline = ctx->options.timeLimitMs ? monotonicNanos() + ctx->options.timeLimitMs * 1000000LL : 0;
+
+    if (positionIsFull(pos)){
+        result.move = -1;
+        result.nodes = 0;
+        return result;
+    }
+    int score = solvePosition(pos, player, weak, ctx);
+    if (!ctx->stopped){
+        //every move but the right ones fails a null window right above the score
+        int moves[MAX_COLS];
+        int count = orderMoves(pos, ctx, -1, moves);
+        orderSolverMoves(pos, player, moves, count, ctx->connectN);
+        int target = weak && score < 0 ? -INF_SCORE : score;
+        for (int i = 0; i < count && !ctx->stopped; i++){
+            int value;
+            if (isWinningMove(pos, player, moves[i], ctx->connectN)){
+                value = WIN_SCORE - 1;
+            }
+            else{
+                positionPlay(pos, player, moves[i]);
+                value = -solveNegamax(pos, 1 - player, -target, -target + 1, 1, ctx);
+                positionUndo(pos, moves[i]);
+            }
+            if (!ctx->stopped && value >= target){
+                result.move = moves[i];
+                result.score = score;
+                result.depth = pos->rows * pos->cols - pos->moveCount;
+                break;
+            }
+        }
+    }
+    result.nodes = ctx->nodes;
+    return result;
+}
+
+MctsTree *mctsCreate(long long sizeMb){
+    //two arenas of sizeMb / 2 each, NULL without memory
+    long long capacity = sizeMb * 1024 * 1024 / (2 * (long long)sizeof(MctsNode));
+    if (capacity > 0x7FFFFFFF)
+        capacity = 0x7FFFFFFF;
+    if (capacity < 1 + MAX_COLS)
+        return NULL;
+    MctsTree *tree = malloc(sizeof(MctsTree));
+    if (tree == NULL)
+        return NULL;
+    tree->nodes = malloc((size_t)capacity * sizeof(MctsNode));
+    tree->spare = malloc((size_t)capacity * sizeof(MctsNode));
+    if (tree->nodes == NULL || tree->spare == NULL){
+        mctsFree(tree);
+        return NULL;
+    }
+    tree->capacity = (uint32_t)capacity;
+    atomic_init(&tree->used, 0);
+    atomic_init(&tree->playouts, 0);
+    tree->valid = 0;
+    return tree;
+}
+
+void mctsFree(MctsTree *tree){
+    if (tree == NULL)
+        return;
+    free(tree->nodes);
+    free(tree->spare);
+    free(tree);
+}
+
+void mctsCopyNode(MctsNode *to, const MctsNode *from){
+    //only while no playouts run
+    atomic_store_explicit(&to->visits, atomic_load_explicit(&from->visits, memory_order_relaxed), memory_order_relaxed);
+    atomic_store_explicit(&to->score, atomic_load_explicit(&from->score, memory_order_relaxed), memory_order_relaxed);
+    atomic_store_explicit(&to->children, atomic_load_explicit(&from->children, memory_order_relaxed), memory_order_relaxed);
+    to->move = from->move;
+    to->childCount = from->childCount;
+    to->terminal = from->terminal;
+}
+
+uint32_t mctsFind(const MctsTree *tree, uint32_t index, const Position *at, int player, const Position *target, int plies){
+    //the node below index (at, player to move) holding target at most plies deeper, MCTS_NONE if there is none
+    if (at->moveCount == target->moveCount)
+        return at->tokens[0] == target->tokens[0] && at->tokens[1] == target->tokens[1] ? index : MCTS_NONE;
+    uint32_t children = atomic_load_explicit(&tree->nodes[index].children, memory_order_relaxed);
+    if (plies == 0 || children == 0 || children == MCTS_LEAF)
+        return MCTS_NONE;
+    for (int i = 0; i < tree->nodes[index].childCount; i++){
+        Position next = *at;
+        positionPlay(&next, player, tree->nodes[children + i].move);
+        if (next.tokens[player] & ~target->tokens[player])
+            continue;
+        uint32_t found = mctsFind(tree, children + i, &next, 1 - player, target, plies - 1);
+        if (found != MCTS_NONE)
+            return found;
+    }
+    return MCTS_NONE;
+}
+
+void mctsKeepSubtree(MctsTree *tree, uint32_t index){
+    //copies the subtree under index into the spare arena breadth first, so its root lands
+    //on 0 and every family stays together, then swaps the arenas. the rest of the old
+    //tree, the moves that were not played, is dropped.
+    MctsNode *from = tree->nodes;
+    MctsNode *to = tree->spare;
+    mctsCopyNode(&to[0], &from[index]);
+    uint32_t used = 1;
+    for (uint32_t i = 0; i < used; i++){
+        uint32_t children = atomic_load_explicit(&to[i].children, memory_order_relaxed);
+        if (children == 0 || children == MCTS_LEAF)
+            continue;
+        for (int c = 0; c < to[i].childCount; c++)
+            mctsCopyNode(&to[used + c], &from[children + c]);
+        atomic_store_explicit(&to[i].children, used, memory_order_relaxed);
+        used += (uint32_t)to[i].childCount;
+    }
+    tree->nodes = to;
+    tree->spare = from;
+    atomic_store(&tree->used, used);
+}
+
+void mctsSetRoot(MctsTree *tree, const Position *pos, int player){
+    //reuses the tree of the previous move when pos is in it, usually two plies below its root
+    //after the opponent's reply, or one when it pondered on the opponent's move
+    uint32_t index = MCTS_NONE;
+    if (tree->valid && pos->moveCount >= tree->root.moveCount && (pos->moveCount - tree->root.moveCount) % 2 == (player != tree->rootPlayer))
+        index = mctsFind(tree, 0, &tree->root, tree->rootPlayer, pos, 2);
+    if (index == MCTS_NONE){
+        MctsNode *root = &tree->nodes[0];
+        atomic_store_explicit(&root->visits, 0, memory_order_relaxed);
+        atomic_store_explicit(&root->score, 0, memory_order_relaxed);
+        atomic_store_explicit(&root->children, 0, memory_order_relaxed);
+        root->move = -1;
+        root->childCount = 0;
+        root->terminal = MCTS_OPEN;
+        atomic_store(&tree->used, 1);
+    }
+    else if (index != 0)
+        mctsKeepSubtree(tree, index);
+    tree->root = *pos;
+    tree->rootPlayer = player;
+    tree->valid = 1;
+}
+
+uint32_t mctsExpand(MctsTree *tree, MctsNode *node, const Position *pos, int player, int connectN, const int order[MAX_COLS]){
+    //creates the children of node, which the caller switched to MCTS_EXPANDING, for the moves
+    //of generateMoves: an end of the game is known two plies early. returns and publishes the
+    //first child, MCTS_LEAF for a node that ends the game or 0 when the arena is full.
+    Bitboard wins[2];
+    positionWinningCells(pos, connectN, wins);
+    Bitboard playable = positionPlayableCells(pos);
+    int moves[MAX_COLS];
+    int count = 0;
+    if (positionIsFull(pos))
+        node->terminal = MCTS_DRAW;
+    else if (wins[player] & playable)
+        node->terminal = MCTS_LOSS;
+    else if ((count = generateMoves(pos, player, wins, playable, order, moves)) == 0)
+        node->terminal = MCTS_WIN;
+    if (node->terminal != MCTS_OPEN){
+        atomic_store_explicit(&node->children, MCTS_LEAF, memory_order_release);
+        return MCTS_LEAF;
+    }
+
+    uint32_t first = atomic_fetch_add_explicit(&tree->used, (uint32_t)count, memory_order_relaxed);
+    if (first + (uint32_t)count > tree->capacity){
+        atomic_store_explicit(&node->children, 0, memory_order_release);
+        return 0;
+    }
+    int full = pos->moveCount + 1 == pos->rows * pos->cols;
+    for (int i = 0; i < count; i++){
+        MctsNode *child = &tree->nodes[first + i];
+        atomic_store_explicit(&child->visits, 0, memory_order_relaxed);
+        atomic_store_explicit(&child->score, 0, memory_order_relaxed);
+        atomic_store_explicit(&child->children, full ? MCTS_LEAF : 0, memory_order_relaxed);
+        child->move = (int8_t)moves[i];
+        child->childCount = 0;
+        child->terminal = full ? MCTS_DRAW : MCTS_OPEN;
+    }
+    node->childCount = (int8_t)count;
+    atomic_store_explicit(&node->children, first, memory_order_release);
+    return first;
+}
+
+long long integerSquareRoot(long long n){
+    //floor(sqrt(n)) by Newton's method, without libm
+    if (n < 2)
+        return n;
+    long long x = n, y = (x + 1) / 2;
+    while (y < x){
+        x = y;
+        y = (x + n / x) / 2;
+    }
+    return x;
+}
+
+uint32_t mctsSelect(const MctsTree *tree, const MctsNode *node, uint32_t first){
+    //the child with the best mean result plus exploration bonus. a child nobody has visited
+    //yet goes first, in center-first order. running playouts already count as visits without
+    //a result, a virtual loss that sends other threads down other paths.
+    double exploration = MCTS_EXPLORATION * (double)integerSquareRoot(atomic_load_explicit(&node->visits, memory_order_relaxed));
+    uint32_t best = first;
+    double bestValue = -1.0;
+    for (int i = 0; i < node->childCount; i++){
+        const MctsNode *child = &tree->nodes[first + i];
+        int visits = atomic_load_explicit(&child->visits, memory_order_relaxed);
+        if (visits == 0)
+            return first + (uint32_t)i;
+        double value = atomic_load_explicit(&child->score, memory_order_relaxed) / (2.0 * visits)
+                     + exploration / (1 + visits);
+        if (value > bestValue){
+            bestValue = value;
+            best = first + (uint32_t)i;
+        }
+    }
+    return best;
+}
+
+int mctsRollout(Position *pos, int player, int connectN, const int order[MAX_COLS], uint64_t *rngState){
+    //plays pos out with player to move and returns the winner, -1 for a draw. wins and blocks
+    //are always played; otherwise the rule player moves on half the plies and a random column
+    //on the others, so playouts from one position differ.
+    while (!positionIsFull(pos)){
+        Bitboard wins[2];
+        positionWinningCells(pos, connectN, wins);
+        Bitboard playable = positionPlayableCells(pos);
+        if (wins[player] & playable)
+            return player;
+        int col;
+        uint64_t random = nextRandom(rngState);
+        if (wins[1 - player] & playable)
+            col = firstColumnIn(pos, wins[1 - player] & playable, order);
+        else if (random & 1)
+            col = generatePositionMove(pos, player, connectN, order);
+        else{
+            int moves[MAX_COLS];
+            int count = 0;
+            for (int c = 0; c < pos->cols; c++){
+                if (positionCanPlay(pos, c))
+                    moves[count++] = c;
+            }
+            col = moves[(random >> 1) % (uint64_t)count];
+        }
+        positionPlay(pos, player, col);
+        player = 1 - player;
+    }
+    return -1;
+}
+
+int mctsPlayout(MctsTree *tree, int connectN, const int order[MAX_COLS], uint64_t *rngState){
+    //one descent from the root, expansion, rollout and update of the path.
+    //returns the number of tree nodes on the path.
+    Position pos = tree->root;
+    int player = tree->rootPlayer;
+    uint32_t path[MAX_CELLS + 1];
+    int length = 0;
+    int winner;
+    uint32_t index = 0;
+    for (;;){
+        MctsNode *node = &tree->nodes[index];
+        int visits = atomic_fetch_add_explicit(&node->visits, 1, memory_order_relaxed);
+        path[length++] = index;
+        uint32_t children = atomic_load_explicit(&node->children, memory_order_acquire);
+        if (children == 0 && visits >= MCTS_EXPAND_VISITS && atomic_load_explicit(&tree->used, memory_order_relaxed) + MAX_COLS <= tree->capacity
+            && atomic_compare_exchange_strong(&node->children, &children, MCTS_EXPANDING))
+            children = mctsExpand(tree, node, &pos, player, connectN, order);
+        if (children == MCTS_LEAF){
+            //terminal is relative to the player who moved into the node
+            winner = node->terminal == MCTS_DRAW ? -1 : node->terminal == MCTS_WIN ? 1 - player : player;
+            break;
+        }
+        if (children == 0 || children == MCTS_EXPANDING){
+            winner = mctsRollout(&pos, player, connectN, order, rngState);
+            break;
+        }
+        index = mctsSelect(tree, node, children);
+        positionPlay(&pos, player, tree->nodes[index].move);
+        player = 1 - player;
+    }
+
+    //the root is owned by the player who moved into it, then owners alternate
+    int owner = 1 - tree->rootPlayer;
+    for (int i = 0; i < length; i++){
+        int points = winner == -1 ? 1 : winner == owner ? 2 : 0;
+        atomic_fetch_add_explicit(&tree->nodes[path[i]].score, points, memory_order_relaxed);
+        owner = 1 - owner;
+    }
+    return length;
+}
+
+int mctsBudgetExceeded(MctsTree *tree, const SearchContext *ctx, long long playouts){
+    //adds a thread's playouts to the move's total and checks every budget
+    long long total = atomic_fetch_add_explicit(&tree->playouts, playouts, memory_order_relaxed) + playouts;
+    if (ctx->stopSignal && atomic_load_explicit(ctx->stopSignal, memory_order_relaxed))
+        return 1;
+    if (ctx->options.nodeLimit && total >= ctx->options.nodeLimit)
+        return 1;
+    return ctx->deadline && monotonicNanos() >= ctx->deadline;
+}
+
+void mctsRun(MctsWorker *worker){
+    do {
+        for (int i = 0; i < MCTS_CHUNK; i++){
+            int depth = mctsPlayout(worker->tree, worker->ctx->connectN, worker->ctx->order, &worker->rngState);
+            if (depth > worker->depth)
+                worker->depth = depth;
+        }
+        worker->playouts += MCTS_CHUNK;
+        threadCounters.nodes += MCTS_CHUNK;
+    } while (!mctsBudgetExceeded(worker->tree, worker->ctx, MCTS_CHUNK));
+}
+
+void *mctsWorker(void *arg){
+    mctsRun(arg);
+    countersFlush();
+    return NULL;
+}
+
+SearchResult mctsBestMove(Position *pos, int player, SearchContext *ctx){
+    //Monte Carlo tree search on searchThreads threads sharing one tree, reused from the
+    //previous move. the answer is the most visited move; score is its mean result for
+    //player in thousandths from -1000 (lost) to 1000 (won), depth the longest tree path.
+    SearchResult result;
+    result.move = generatePositionMove(pos, player, ctx->connectN, ctx->order);
+    result.score = 0;
+    result.depth = 0;
+    result.nodes = 0;
+    ctx->nodes = 0;
+    ctx->stopped = 0;
+    MctsTree *tree = ctx->mcts;
+    if (tree == NULL)
+        return result;
+
+    ctx->deadline = ctx->options.timeLimitMs ? monotonicNanos() + ctx->options.timeLimitMs * 1000000LL : 0;
+    mctsSetRoot(tree, pos, player);
+    MctsNode *root = &tree->nodes[0];
+    uint32_t first = atomic_load_explicit(&root->children, memory_order_relaxed);
+    if (first == 0){
+        atomic_store_explicit(&root->children, MCTS_EXPANDING, memory_order_relaxed);
+        first = mctsExpand(tree, root, pos, player, ctx->connectN, ctx->order);
+    }
+    //a win on the spot, nothing but losing moves, or a single move that does not lose:
+    //the rules play the first two, the third needs no thinking
+    if (first == MCTS_LEAF)
+        return result;
+    if (root->childCount == 1){
+        result.move = tree->nodes[first].move;
+        return result;
+    }
+
+    atomic_store(&tree->playouts, 0);
+    MctsWorker workers[MAX_SEARCH_THREADS];
+    int started = 1;
+    for (int i = 0; i < ctx->options.searchThreads; i++){
+        workers[i].tree = tree;
+        workers[i].ctx = ctx;
+        workers[i].rngState = mix64(pos->hash ^ mix64((uint64_t)i + 1));
+        workers[i].playouts = 0;
+        workers[i].depth = 0;
+        if (i > 0 && pthread_create(&workers[i].thread, NULL, mctsWorker, &workers[i]) != 0)
+            break;
+        started = i + 1;
+    }
+    mctsRun(&workers[0]);
+    for (int i = 0; i < started; i++){
+        if (i > 0)
+            pthread_join(workers[i].thread, NULL);
+        ctx->nodes += workers[i].playouts;
+        if (workers[i].depth > result.depth)
+            result.depth = workers[i].depth;
+    }
+
+    int bestVisits = -1;
+    for (int i = 0; i < root->childCount; i++){
+        const MctsNode *child = &tree->nodes[first + i];
+        int visits = atomic_load_explicit(&child->visits, memory_order_relaxed);
+        if (atomic_load_explicit(&child->children, memory_order_relaxed) == MCTS_LEAF && child->terminal == MCTS_WIN)
+            visits = INT32_MAX;  //proven
+        if (visits > bestVisits){
+            bestVisits = visits;
+            result.move = child->move;
+            int played = atomic_load_explicit(&child->visits, memory_order_relaxed);
+            result.score = played ? (int)((atomic_load_explicit(&child->score, memory_order_relaxed) - played) * 1000LL / played) : 0;
+        }
+    }
+    result.nodes = ctx->nodes;
+    return result;
+}
+
+int batchFitsLanes(int rows, int cols){
+    //the batch keeps a board in one 64-bit word, sentinel row included
+    return (rows + 1) * cols <= 64;
+}
+
+HOT_INLINE void laneWinningCells(const LaneVector *tokens, int rows, int cols, int sequenceNum, LaneVector *cells){
+    //winningCellsNarrow for one player of every lane, empty cells not masked. vectors go
+    //by pointer, a 256-bit argument would depend on whether AVX is enabled.
+    const int shifts[4] = {1, rows + 1, rows, rows + 2};
+    const int lengths[4] = {rows, cols, rows < cols ? rows : cols, rows < cols ? rows : cols};
+    LaneVector found = *tokens & 0;
+    for (int dir = 0; sequenceNum >= 2 && dir < 4; dir++){
+        if (sequenceNum > lengths[dir])
+            continue;
+        LaneVector before[MAX_COLS];
+        before[0] = ~found | found;
+        for (int j = 1; j < sequenceNum; j++)
+            before[j] = before[j - 1] & (*tokens << (j * shifts[dir]));
+        LaneVector after = before[0];
+        found |= before[sequenceNum - 1];
+        for (int i = 1; i < sequenceNum; i++){
+            after &= *tokens >> (i * shifts[dir]);
+            found |= after & before[sequenceNum - 1 - i];
+        }
+    }
+    *cells = found;
+}
+
+void batchRuleMoves(const uint64_t tokens0[], const uint64_t tokens1[], const uint8_t players[], int count, int rows, int cols, int connectN, const int indexMap[MAX_COLS], int8_t moves[]){
+    //generatePositionMove for count boards given as a structure of arrays: the tokens of
+    //player 0 and player 1 and the player to move on each board. the boards must fit
+    //batchFitsLanes. every priority is worked out for all lanes at once, without branches:
+    //a lane keeps the first of the five cell sets that is not empty, then the first column
+    //in indexMap order with a cell in it. -1 for a full board.
+    uint64_t columnMask[MAX_COLS];
+    uint64_t bottom = 0;
+    uint64_t boardMask = 0;
+    for (int col = 0; col < cols; col++){
+        columnMask[col] = ((1ULL << rows) - 1) << (col * (rows + 1));
+        bottom |= 1ULL << (col * (rows + 1));
+        boardMask |= columnMask[col];
+    }
+
+    for (int first = 0; first < count; first += BOARD_LANES){
+        //a short last group runs on empty boards in its spare lanes
+        LaneVector own, other;
+        for (int lane = 0; lane < BOARD_LANES; lane++){
+            int i = first + lane < count ? first + lane : -1;
+            uint64_t t0 = i < 0 ? 0 : tokens0[i];
+            uint64_t t1 = i < 0 ? 0 : tokens1[i];
+            own[lane] = i >= 0 && players[i] ? t1 : t0;
+            other[lane] = i >= 0 && players[i] ? t0 : t1;
+        }
+
+        //the lowest empty cell of every column: adding the bottom row carries past the
+        //tokens, a full column carries into the sentinel row outside boardMask
+        LaneVector playable = ((own | other) + bottom) & boardMask;
+        LaneVector priorities[5];
+        laneWinningCells(&own, rows, cols, connectN, &priorities[0]);
+        laneWinningCells(&other, rows, cols, connectN, &priorities[1]);
+        laneWinningCells(&own, rows, cols, connectN - 1, &priorities[2]);
+        laneWinningCells(&other, rows, cols, connectN - 1, &priorities[3]);
+        priorities[4] = playable;
+        //all ones in the lanes where x is not 0: (x | -x) has the top bit set exactly then.
+        //shifts and subtractions, unlike 64-bit compares, are in plain SSE2.
+        LaneVector cells = priorities[0] & playable;
+        for (int p = 1; p < 5; p++){
+            LaneVector found = 0 - ((cells | (0 - cells)) >> 63);
+            cells |= priorities[p] & playable & ~found;
+        }
+
+        //walking indexMap backwards leaves the first matching column in each lane
+        LaneVector move = ~(cells & 0);
+        for (int k = cols - 1; k >= 0; k--){
+            LaneVector inColumn = cells & columnMask[indexMap[k]];
+            LaneVector hit = 0 - ((inColumn | (0 - inColumn)) >> 63);
+            move = (move & ~hit) | ((uint64_t)indexMap[k] & hit);
+        }
+        for (int lane = 0; lane < BOARD_LANES && first + lane < count; lane++)
+            moves[first + lane] = (int8_t)move[lane];
+    }
+}
+
+void defaultBatchOptions(BatchOptions *batch){
+    batch->games = 0;
+    batch->threads = 0;
+    batch->seed = 1;
+    batch->randomPlies = DEFAULT_RANDOM_PLIES;
+    batch->recordPath = NULL;
+}
+
+int parseBatchOption(BatchOptions *batch, const char *arg){
+    //same contract as parseEngineOption
+    if (strncmp(arg, "--batch=", 8) == 0){
+        batch->games = atoll(arg + 8);
+        return batch->games > 0;
+    }
+    if (strncmp(arg, "--threads=", 10) == 0){
+        batch->threads = atoi(arg + 10);
+        return batch->threads > 0;
+    }
+    if (strncmp(arg, "--seed=", 7) == 0){
+        batch->seed = strtoull(arg + 7, NULL, 10);
+        return 1;
+    }
+    if (strncmp(arg, "--random-plies=", 15) == 0){
+        batch->randomPlies = atoi(arg + 15);
+        return batch->randomPlies >= 0;
+    }
+    if (strncmp(arg, "--record=", 9) == 0){
+        batch->recordPath = arg + 9;
+        return arg[9] != '\0';
+    }
+    return 0;
+}
+
+int workerThreadCount(int requested){
+    //requested threads, or one per online core for 0
+    if (requested > 0)
+        return requested;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (int)online : 1;
+}
+
+uint64_t mix64(uint64_t z){
+    //splitmix64 finalizer
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+uint64_t nextRandom(uint64_t *state){
+    //splitmix64 generator, the whole state is the caller's
+    *state += 0x9E3779B97F4A7C15ULL;
+    return mix64(*state);
+}
+
+char moveChar(int col){
+    //columns 1-9 as digits like on the board, then letters from 'a'
+    return col < 9 ? (char)('1' + col) : (char)('a' + col - 9);
+}
+
+void playSelfPlayGame(Position *pos, const BoardOptions *board, SearchContext contexts[2], uint64_t rngState, int randomPlies, GameRecord *record){
+    //plays one computer vs computer game without any output.
+    //the first randomPlies moves are random so that the games differ from each other.
+    int player = 0;
+    positionInit(pos, board->rows, board->cols, board->connectN);
+    record->length = 0;
+    record->winner = 0;
+    while (!positionIsFull(pos)){
+        int col;
+        if (record->length < randomPlies){
+            int choices[MAX_COLS];
+            int count = orderMoves(pos, &contexts[player], -1, choices);
+            col = choices[nextRandom(&rngState) % count];
+        }
+        else{
+            col = computerPlayerMove(pos, player, &contexts[player]);
+        }
+
+        if (!selfPlayMove(pos, player, col, record))
+            break;
+        player = 1 - player;
+    }
+}
+
+int selfPlayMove(Position *pos, int player, int col, GameRecord *record){
+    //plays and records a self-play move, returns 0 once the game is over
+    positionPlay(pos, player, col);
+    record->moves[record->length++] = (int8_t)col;
+    if (positionMoveMakesSequence(pos, player, col, pos->connectN)){
+        record->winner = player + 1;
+        return 0;
+    }
+    return !positionIsFull(pos);
+}
+
+void playSelfPlayRuleGames(const BoardOptions *board, const SearchContext *ctx, const uint64_t rngStates[], int randomPlies, GameRecord records[], int count){
+    //playSelfPlayGame for up to BATCH_CHUNK rule player games at once: every round each
+    //unfinished game makes one move, and the rule moves of the round are chosen in one
+    //batchRuleMoves call. each game still only depends on its own random state, so the
+    //records are the ones playSelfPlayGame would write.
+    Position positions[BATCH_CHUNK];
+    uint64_t rng[BATCH_CHUNK];
+    int running[BATCH_CHUNK];
+    uint64_t tokens[2][BATCH_CHUNK];
+    uint8_t players[BATCH_CHUNK];
+    int8_t moves[BATCH_CHUNK];
+    int games[BATCH_CHUNK];
+    for (int g = 0; g < count; g++){
+        positionInit(&positions[g], board->rows, board->cols, board->connectN);
+        rng[g] = rngStates[g];
+        running[g] = 1;
+        records[g].length = 0;
+        records[g].winner = 0;
+    }
+
+    int active = count;
+    while (active > 0){
+        int batched = 0;
+        for (int g = 0; g < count; g++){
+            if (!running[g])
+                continue;
+            Position *pos = &positions[g];
+            int player = records[g].length & 1;
+            if (records[g].length < randomPlies){
+                int choices[MAX_COLS];
+                int choiceCount = orderMoves(pos, ctx, -1, choices);
+                int col = choices[nextRandom(&rng[g]) % choiceCount];
+                if (!selfPlayMove(pos, player, col, &records[g])){
+                    running[g] = 0;
+                    active--;
+                }
+                continue;
+            }
+            tokens[0][batched] = (uint64_t)pos->tokens[0];
+            tokens[1][batched] = (uint64_t)pos->tokens[1];
+            players[batched] = (uint8_t)player;
+            games[batched++] = g;
+        }
+
+        batchRuleMoves(tokens[0], tokens[1], players, batched, board->rows, board->cols, board->connectN, ctx->order, moves);
+        threadCounters.computerMoves += batched;
+        for (int i = 0; i < batched; i++){
+            int g = games[i];
+            if (!selfPlayMove(&positions[g], players[i], moves[i], &records[g])){
+                running[g] = 0;
+                active--;
+            }
+        }
+    }
+}
+
+void *batchWorker(void *arg){
+    //every worker owns its position and search contexts (move order and tables included),
+    //reset before each game, and only shares the job counter and the ordered output
+    BatchJob *job = arg;
+    Position pos;
+    SearchContext contexts[2];
+    GameRecord records[BATCH_CHUNK];
+    searchContextInit(&contexts[0], job->engine, job->board->cols, job->board->connectN);
+    searchContextInit(&contexts[1], job->engine, job->board->cols, job->board->connectN);
+    //rule players without a book (or timing) play a whole chunk of games side by side
+    int lockstep = job->engine->aiMode == AI_RULE && job->engine->book == NULL && !job->engine->showStats
+                && batchFitsLanes(job->board->rows, job->board->cols);
+
+    while (1){
+        long long first = atomic_fetch_add(&job->nextGame, BATCH_CHUNK);
+        if (first >= job->batch->games)
+            break;
+        long long last = first + BATCH_CHUNK < job->batch->games ? first + BATCH_CHUNK : job->batch->games;
+        //seeded per game, so the results do not depend on the thread count
+        uint64_t rngStates[BATCH_CHUNK];
+        for (long long game = first; game < last; game++)
+            rngStates[game - first] = mix64(job->batch->seed ^ mix64((uint64_t)game + 1));
+        if (lockstep){
+            playSelfPlayRuleGames(job->board, &contexts[0], rngStates, job->batch->randomPlies, records, (int)(last - first));
+        }
+        else{
+            for (long long game = first; game < last; game++){
+                //fresh tables for every game, so a game does not depend on the games the
+                //worker played before it
+                searchContextReset(&contexts[0]);
+                searchContextReset(&contexts[1]);
+                playSelfPlayGame(&pos, job->board, contexts, rngStates[game - first], job->batch->randomPlies, &records[game - first]);
+            }
+        }
+        batchEmit(job, first / BATCH_CHUNK, records, (int)(last - first));
+    }
+
+    searchContextFree(&contexts[0]);
+    searchContextFree(&contexts[1]);
+    countersFlush();
+    return NULL;
+}
+
+void batchEmit(BatchJob *job, long long chunk, const GameRecord records[], int count){
+    //hands a finished chunk to the ordered output: it goes out at once when every earlier
+    //chunk is out, otherwise it waits in the window for them. a worker more than the window
+    //ahead of the oldest unfinished chunk waits for a free slot.
+    pthread_mutex_lock(&job->lock);
+    while (chunk - job->nextChunk >= job->windowChunks)
+        pthread_cond_wait(&job->slotFree, &job->lock);
+    long long slot = chunk % job->windowChunks;
+    memcpy(&job->window[slot * BATCH_CHUNK], records, (size_t)count * sizeof(GameRecord));
+    job->windowReady[slot] = count;
+
+    char moves[MAX_CELLS + 1];
+    int written = 0;
+    while (job->windowReady[slot = job->nextChunk % job->windowChunks] > 0){
+        for (int i = 0; i < job->windowReady[slot]; i++){
+            const GameRecord *record = &job->window[slot * BATCH_CHUNK + i];
+            recordMoveString(record, moves);
+            printf("%lld %d %d %s\n", job->nextChunk * BATCH_CHUNK + i, record->winner, record->length, moves);
+            job->wins[record->winner]++;
+            if (job->recordFile != NULL && job->recorded && !gameWriterWrite(job->recordFile, record)){
+                //said once, when it happens; the batch itself goes on
+                fprintf(stderr, "Cannot write games to %s.\n", job->batch->recordPath);
+                job->recorded = 0;
+            }
+        }
+        job->windowReady[slot] = 0;
+        job->nextChunk++;
+        written = 1;
+    }
+    if (written)
+        pthread_cond_broadcast(&job->slotFree);
+    pthread_mutex_unlock(&job->lock);
+}
+
+int runBatch(const EngineOptions *engine, const BatchOptions *batch, const BoardOptions *board){
+    //plays batch->games games on a pool of worker threads and prints one line per game as
+    //the games finish, in game order: <game> <winner: 0 draw, 1 or 2> <length> <moves>,
+    //then a summary on stderr
+    int threads = workerThreadCount(batch->threads);
+
+    BatchJob job;
+    job.engine = engine;
+    job.batch = batch;
+    job.board = board;
+    atomic_init(&job.nextGame, 0);
+    job.windowChunks = 2 * (long long)threads;
+    job.window = malloc((size_t)job.windowChunks * BATCH_CHUNK * sizeof(GameRecord));
+    job.windowReady = calloc((size_t)job.windowChunks, sizeof(int));
+    pthread_t *workers = malloc((size_t)threads * sizeof(pthread_t));
+    if (job.window == NULL || job.windowReady == NULL || workers == NULL){
+        fprintf(stderr, "Out of memory for %d threads.\n", threads);
+        free(job.window);
+        free(job.windowReady);
+        free(workers);
+        return 0;
+    }
+    job.nextChunk = 0;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.slotFree, NULL);
+    job.recordFile = NULL;
+    job.recorded = 1;
+    job.wins[0] = job.wins[1] = job.wins[2] = 0;
+    if (batch->recordPath != NULL && !gameWriterOpen(&job.recordFile, batch->recordPath, board)){
+        //before any game is played, not after a long batch
+        fprintf(stderr, "Cannot write games to %s.\n", batch->recordPath);
+        pthread_mutex_destroy(&job.lock);
+        pthread_cond_destroy(&job.slotFree);
+        free(job.window);
+        free(job.windowReady);
+        free(workers);
+        return 0;
+    }
+
+    long long start = monotonicNanos();
+    int started = 0;
+    for (; started < threads; started++){
+        if (pthread_create(&workers[started], NULL, batchWorker, &job) != 0)
+            break;
+    }
+    if (started == 0){
+        //no thread could be created, play everything here
+        batchWorker(&job);
+    }
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    double seconds = (monotonicNanos() - start) / 1e9;
+
+    if (job.recordFile != NULL && fclose(job.recordFile) != 0 && job.recorded)
+        fprintf(stderr, "Cannot write games to %s.\n", batch->recordPath);
+
+    fprintf(stderr, "%lld games on %d threads in %.3f s (%.1f games/s): player 1 %lld, player 2 %lld, draws %lld\n",
+            batch->games, started ? started : 1, seconds, seconds > 0 ? batch->games / seconds : 0.0,
+            job.wins[1], job.wins[2], job.wins[0]);
+    if (engine->showStats){
+        EngineCounters counters;
+        countersTotal(&counters);
+        dumpCounters(stderr, &counters);
+    }
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.slotFree);
+    free(job.window);
+    free(job.windowReady);
+    free(workers);
+    return 1;
+}
+
+void recordMoveString(const GameRecord *record, char moves[MAX_CELLS + 1]){
+    //the text form of a game, one moveChar per move
+    for (int i = 0; i < record->length; i++)
+        moves[i] = moveChar(record->moves[i]);
+    moves[record->length] = '\0';
+}
+
+int gameWriterOpen(FILE **file, const char *path, const BoardOptions *board){
+    //creates a binary game file and writes its header, returns 0 on failure
+    *file = fopen(path, "wb");
+    if (*file == NULL)
+        return 0;
+
+    GameFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GAMES_MAGIC, sizeof(header.magic));
+    header.rows = (uint8_t)board->rows;
+    header.cols = (uint8_t)board->cols;
+    header.connectN = (uint8_t)board->connectN;
+    if (fwrite(&header, sizeof(header), 1, *file) != 1){
+        fclose(*file);
+        *file = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+int gameWriterWrite(FILE *file, const GameRecord *record){
+    //appends one record, columns fit in a nibble since MAX_COLS is 16
+    uint8_t bytes[2 + MAX_CELLS / 2];
+    bytes[0] = (uint8_t)record->length;
+    bytes[1] = (uint8_t)record->winner;
+    for (int i = 0; i < record->length; i += 2){
+        uint8_t high = i + 1 < record->length ? (uint8_t)record->moves[i + 1] : 0;
+        bytes[2 + i / 2] = (uint8_t)(record->moves[i] | high << 4);
+    }
+    size_t size = 2 + (size_t)(record->length + 1) / 2;
+    return fwrite(bytes, 1, size, file) == size;
+}
+
+int gameReaderOpen(GameReader *reader, const char *path, const BoardOptions *board){
+    //opens a binary or text game file, telling them apart by the header
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL)
+        return 0;
+
+    reader->board = *board;
+    GameFileHeader header;
+    reader->binary = fread(&header, sizeof(header), 1, reader->file) == 1
+                  && memcmp(header.magic, GAMES_MAGIC, sizeof(header.magic)) == 0;
+    if (reader->binary){
+        reader->board.rows = header.rows;
+        reader->board.cols = header.cols;
+        reader->board.connectN = header.connectN;
+        if (!isValidBoardSize(header.rows, header.cols, header.connectN)){
+            fclose(reader->file);
+            return 0;
+        }
+    }
+    else{
+        rewind(reader->file);
+    }
+    return 1;
+}
+
+int gameReaderNext(GameReader *reader, GameRecord *record){
+    //reads the next game: returns 1 for a game, 0 at the end of the file and -1 for a
+    //record that cannot be read. the moves are not checked, see replayGame.
+    if (reader->binary){
+        uint8_t head[2];
+        size_t got = fread(head, 1, 2, reader->file);
+        if (got == 0)
+            return 0;
+        if (got != 2 || head[0] > MAX_CELLS || head[1] > 2)
+            return -1;
+        uint8_t bytes[MAX_CELLS / 2];
+        size_t size = (size_t)(head[0] + 1) / 2;
+        if (fread(bytes, 1, size, reader->file) != size)
+            return -1;
+        record->length = head[0];
+        record->winner = head[1];
+        for (int i = 0; i < record->length; i++)
+            record->moves[i] = (int8_t)((bytes[i / 2] >> (i % 2 * 4)) & 0x0F);
+        return 1;
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof(line), reader->file) != NULL){
+        //the move string is the last field of the line
+        char *end = line + strlen(line);
+        while (end > line && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+            end--;
+        if (end == line)
+            continue;  //empty line
+        char *start = end;
+        while (start > line && start[-1] != ' ' && start[-1] != '\t')
+            start--;
+        if (end - start > MAX_CELLS)
+            return -1;
+        record->length = 0;
+        record->winner = -1;  //unknown until replayed
+        for (char *c = start; c < end; c++){
+            int col = moveFromChar(*c);
+            if (col < 0)
+                return -1;
+            record->moves[record->length++] = (int8_t)col;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+int replayGame(const GameRecord *record, const BoardOptions *board, char grid[][MAX_COLS]){
+    //plays the record through insertToken on a char board and returns the winner it finds
+    //(0 for none), or -1 if a move is illegal or comes after the end of the game
+    initBoard(grid, board->rows, board->cols);
+    int winner = 0;
+    for (int i = 0; i < record->length; i++){
+        char token = i % 2 == 0 ? TOKEN_P1 : TOKEN_P2;
+        int col = record->moves[i];
+        if (winner || !insertToken(grid, board->rows, board->cols, token, col))
+            return -1;
+        int row = board->rows - getColumnHeight(grid, board->rows, col);
+        if (checkIfNumSequenceForPlayerBecauseOfLastMove(token, grid, board->rows, board->cols, board->connectN, row, col))
+            winner = i % 2 + 1;
+    }
+    return winner;
+}
+
+int runReplay(const char *path, const BatchOptions *batch, const BoardOptions *board){
+    //replays every game of the file and prints it like the batch output; with --record the
+    //games are also written to a binary game file. returns 0 if any game is broken.
+    GameReader reader;
+    if (!gameReaderOpen(&reader, path, board)){
+        fprintf(stderr, "Cannot read games from %s.\n", path);
+        return 0;
+    }
+    FILE *recordFile = NULL;
+    if (batch->recordPath != NULL && !gameWriterOpen(&recordFile, batch->recordPath, &reader.board)){
+        fprintf(stderr, "Cannot write games to %s.\n", batch->recordPath);
+        fclose(reader.file);
+        return 0;
+    }
+
+    char grid[MAX_ROWS][MAX_COLS];
+    char moves[MAX_CELLS + 1];
+    GameRecord record;
+    long long game = 0;
+    long long broken = 0;
+    int status;
+    while ((status = gameReaderNext(&reader, &record)) != 0){
+        int winner = status < 0 ? -1 : replayGame(&record, &reader.board, grid);
+        if (winner < 0 || (record.winner >= 0 && record.winner != winner)){
+            fprintf(stderr, "Game %lld is broken.\n", game);
+            broken++;
+            if (status < 0)
+                break;  //the rest of the file cannot be trusted
+        }
+        else{
+            record.winner = winner;
+            recordMoveString(&record, moves);
+            printf("%lld %d %d %s\n", game, record.winner, record.length, moves);
+            if (recordFile != NULL && !gameWriterWrite(recordFile, &record)){
+                fprintf(stderr, "Cannot write games to %s.\n", batch->recordPath);
+                broken++;
+                break;
+            }
+        }
+        game++;
+    }
+
+    fclose(reader.file);
+    if (recordFile != NULL && fclose(recordFile) != 0)
+        broken++;
+    fprintf(stderr, "%lld games replayed, %lld broken\n", game, broken);
+    return broken == 0;
+}
+
+void *analysisWorker(void *arg){
+    //takes games off the queue and searches the position before every move
+    AnalysisQueue *queue = arg;
+    SearchContext ctx;
+    searchContextInit(&ctx, queue->engine, queue->board->cols, queue->board->connectN);
+    //a whole line: game number, two move strings and a score per move
+    char line[64 + 2 * (MAX_CELLS + 1) + MAX_CELLS * 8];
+
+    while (1){
+        pthread_mutex_lock(&queue->lock);
+        while (queue->count == 0 && !queue->done)
+            pthread_cond_wait(&queue->notEmpty, &queue->lock);
+        if (queue->count == 0){
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+        GameRecord record = queue->records[queue->head];
+        long long game = queue->indices[queue->head];
+        queue->head = (queue->head + 1) % ANALYSIS_QUEUE;
+        queue->count--;
+        pthread_cond_signal(&queue->notFull);
+        pthread_mutex_unlock(&queue->lock);
+
+        char played[MAX_CELLS + 1];
+        char engineMoves[MAX_CELLS + 1];
+        int scores[MAX_CELLS];
+        long long agreements = 0;
+        recordMoveString(&record, played);
+        //a fresh table per game, so the scores do not depend on which worker got the game
+        searchContextReset(&ctx);
+        Position pos;
+        positionInit(&pos, queue->board->rows, queue->board->cols, queue->board->connectN);
+        for (int i = 0; i < record.length; i++){
+            SearchResult result = searchBestMove(&pos, i % 2, &ctx);
+            engineMoves[i] = moveChar(result.move);
+            scores[i] = result.score;
+            agreements += result.move == record.moves[i];
+            positionPlay(&pos, i % 2, record.moves[i]);
+        }
+        engineMoves[record.length] = '\0';
+
+        int used = sprintf(line, "%lld %s %s", game, played, engineMoves);
+        for (int i = 0; i < record.length; i++)
+            used += sprintf(line + used, "%c%d", i == 0 ? ' ' : ',', scores[i]);
+        pthread_mutex_lock(&queue->outputLock);
+        puts(line);
+        queue->positions += record.length;
+        queue->agreements += agreements;
+        pthread_mutex_unlock(&queue->outputLock);
+    }
+
+    searchContextFree(&ctx);
+    countersFlush();
+    return NULL;
+}
+
+int runGameAnalysis(const EngineOptions *engine, const char *path, const BatchOptions *batch, const BoardOptions *board){
+    //streams the games of a file through a bounded queue to a pool of search workers, so
+    //memory stays the same for any file size. lines come out in the order games finish.
+    GameReader reader;
+    if (!gameReaderOpen(&reader, path, board)){
+        fprintf(stderr, "Cannot read games from %s.\n", path);
+        return 0;
+    }
+    EngineOptions options = *engine;
+    options.aiMode = AI_SEARCH;
+
+    AnalysisQueue *queue = malloc(sizeof(AnalysisQueue));
+    int threads = workerThreadCount(batch->threads);
+    pthread_t *workers = malloc((size_t)threads * sizeof(pthread_t));
+    if (queue == NULL || workers == NULL){
+        fprintf(stderr, "Out of memory for the game analysis.\n");
+        free(queue);
+        free(workers);
+        fclose(reader.file);
+        return 0;
+    }
+    queue->head = 0;
+    queue->count = 0;
+    queue->done = 0;
+    queue->positions = 0;
+    queue->agreements = 0;
+    queue->engine = &options;
+    queue->board = &reader.board;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->notEmpty, NULL);
+    pthread_cond_init(&queue->notFull, NULL);
+    pthread_mutex_init(&queue->outputLock, NULL);
+
+    long long start = monotonicNanos();
+    int started = 0;
+    for (; started < threads; started++){
+        if (pthread_create(&workers[started], NULL, analysisWorker, queue) != 0)
+            break;
+    }
+
+    char grid[MAX_ROWS][MAX_COLS];
+    GameRecord record;
+    long long game = 0;
+    long long broken = 0;
+    int status;
+    while ((status = gameReaderNext(&reader, &record)) != 0){
+        //only complete, legal games are analyzed; the last position must not be over
+        if (status < 0 || replayGame(&record, &reader.board, grid) < 0){
+            fprintf(stderr, "Game %lld is broken.\n", game);
+            broken++;
+            if (status < 0)
+                break;
+            game++;
+            continue;
+        }
+        pthread_mutex_lock(&queue->lock);
+        while (queue->count == ANALYSIS_QUEUE)
+            pthread_cond_wait(&queue->notFull, &queue->lock);
+        int tail = (queue->head + queue->count) % ANALYSIS_QUEUE;
+        queue->records[tail] = record;
+        queue->indices[tail] = game;
+        queue->count++;
+        pthread_cond_signal(&queue->notEmpty);
+        pthread_mutex_unlock(&queue->lock);
+        game++;
+
+        if (started == 0){
+            //no worker thread could be created, analyze here as the games arrive
+            pthread_mutex_lock(&queue->lock);
+            queue->done = 1;
+            pthread_mutex_unlock(&queue->lock);
+            analysisWorker(queue);
+            queue->done = 0;
+        }
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    queue->done = 1;
+    pthread_cond_broadcast(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    double seconds = (monotonicNanos() - start) / 1e9;
+
+    fprintf(stderr, "%lld games, %lld positions on %d threads in %.3f s (%.1f positions/s), "
+            "engine agrees with %.1f%% of the moves, %lld broken games\n",
+            game - broken, queue->positions, started ? started : 1, seconds,
+            seconds > 0 ? queue->positions / seconds : 0.0,
+            queue->positions ? 100.0 * queue->agreements / queue->positions : 0.0, broken);
+
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->notEmpty);
+    pthread_cond_destroy(&queue->notFull);
+    pthread_mutex_destroy(&queue->outputLock);
+    free(queue);
+    free(workers);
+    fclose(reader.file);
+    return broken == 0;
+}
+
+void defaultBookOptions(BookOptions *bookOptions){
+    bookOptions->path = NULL;
+    bookOptions->plies = DEFAULT_BOOK_PLIES;
+}
+
+int parseBookOption(BookOptions *bookOptions, const char *arg){
+    //same contract as parseEngineOption
+    if (strncmp(arg, "--make-book=", 12) == 0){
+        bookOptions->path = arg + 12;
+        return arg[12] != '\0';
+    }
+    if (strncmp(arg, "--book-plies=", 13) == 0){
+        bookOptions->plies = atoi(arg + 13);
+        return bookOptions->plies >= 0 && bookOptions->plies <= MAX_CELLS;
+    }
+    return 0;
+}
+
+int bookOpen(OpeningBook *book, const char *path, const BoardOptions *board){
+    //maps the book file and checks that it was made for this board.
+    //returns 0 with a message on stderr if it cannot be used.
+    int fd = open(path, O_RDONLY);
+    if (fd < 0){
+        fprintf(stderr, "Cannot open book %s.\n", path);
+        return 0;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(BookHeader)){
+        fprintf(stderr, "Book %s is not an opening book.\n", path);
+        close(fd);
+        return 0;
+    }
+    book->size = (size_t)info.st_size;
+    book->map = mmap(NULL, book->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  //the mapping stays valid without the descriptor
+    if (book->map == MAP_FAILED){
+        fprintf(stderr, "Cannot map book %s.\n", path);
+        return 0;
+    }
+
+    book->header = book->map;
+    uint64_t count = book->header->count;
+    if (memcmp(book->header->magic, BOOK_MAGIC, sizeof(book->header->magic)) != 0
+        || count > (book->size - sizeof(BookHeader)) / (sizeof(uint64_t) + sizeof(uint32_t))
+        || sizeof(BookHeader) + count * (sizeof(uint64_t) + sizeof(uint32_t)) != book->size){
+        fprintf(stderr, "Book %s is not an opening book.\n", path);
+        bookClose(book);
+        return 0;
+    }
+    if (book->header->rows != board->rows || book->header->cols != board->cols
+        || book->header->connectN != board->connectN){
+        fprintf(stderr, "Book %s was made for %d rows x %d cols, connect %d.\n", path,
+                book->header->rows, book->header->cols, book->header->connectN);
+        bookClose(book);
+        return 0;
+    }
+    book->keys = (const uint64_t *)(book->header + 1);
+    book->entries = (const uint32_t *)(book->keys + count);
+    return 1;
+}
+
+void bookClose(OpeningBook *book){
+    munmap(book->map, book->size);
+    book->map = NULL;
+}
+
+int bookProbe(const OpeningBook *book, const Position *pos, int *score){
+    //returns the book move for the side to move and its score, or -1 if pos is not in the book
+    if (pos->moveCount > book->header->plies)
+        return -1;
+
+    int mirrored;
+    uint64_t key = positionCanonicalKey(pos, &mirrored);
+    uint64_t low = 0;
+    uint64_t high = book->header->count;
+    while (low < high){
+        uint64_t middle = low + (high - low) / 2;
+        if (book->keys[middle] < key)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low == book->header->count || book->keys[low] != key)
+        return -1;
+
+    uint32_t entry = book->entries[low];
+    int move = (int)((entry >> 16) & 0xFF);
+    if (mirrored)
+        move = pos->cols - 1 - move;
+    //a damaged file or a key collision must never make an illegal move
+    if (move >= pos->cols || !positionCanPlay(pos, move))
+        return -1;
+    *score = (int16_t)(uint16_t)entry;
+    return move;
+}
+
+int bookAddPosition(BookJob *job, const Position *pos){
+    //adds pos unless its canonical key is already there.
+    //returns 1 if it was added, 0 if it was already there, -1 without memory.
+    if ((job->count + 1) * 2 > (long long)(job->slotMask + 1)){
+        //keep the set at most half full, rebuilding it from the records
+        uint64_t slotCount = (job->slotMask + 1) * 2;
+        long long *slots = malloc(slotCount * sizeof(long long));
+        BookRecord *records = realloc(job->records, slotCount / 2 * sizeof(BookRecord));
+        if (slots == NULL || records == NULL){
+            free(slots);
+            if (records != NULL)
+                job->records = records;
+            return -1;
+        }
+        job->records = records;
+        job->capacity = (long long)(slotCount / 2);
+        free(job->slots);
+        job->slots = slots;
+        job->slotMask = slotCount - 1;
+        for (uint64_t i = 0; i < slotCount; i++)
+            slots[i] = -1;
+        for (long long i = 0; i < job->count; i++){
+            uint64_t slot = job->records[i].key & job->slotMask;
+            while (slots[slot] != -1)
+                slot = (slot + 1) & job->slotMask;
+            slots[slot] = i;
+        }
+    }
+
+    int mirrored;
+    uint64_t key = positionCanonicalKey(pos, &mirrored);
+    uint64_t slot = key & job->slotMask;
+    while (job->slots[slot] != -1){
+        if (job->records[job->slots[slot]].key == key)
+            return 0;
+        slot = (slot + 1) & job->slotMask;
+    }
+    job->slots[slot] = job->count;
+    job->records[job->count].pos = *pos;
+    job->records[job->count].key = key;
+    job->records[job->count].entry = 0;
+    job->count++;
+    return 1;
+}
+
+int bookCollect(BookJob *job, Position *pos, int player, int plies){
+    //adds pos and every position up to plies moves further that is still being played.
+    //a position seen before was reached with the same token count, so its subtree is done.
+    //returns 0 if memory ran out.
+    int added = bookAddPosition(job, pos);
+    if (added <= 0)
+        return added == 0;
+    if (plies == 0)
+        return 1;
+
+    for (int col = 0; col < pos->cols; col++){
+        if (!positionCanPlay(pos, col))
+            continue;
+        positionPlay(pos, player, col);
+        int ok = 1;
+        if (!positionMoveMakesSequence(pos, player, col, pos->connectN) && !positionIsFull(pos))
+            ok = bookCollect(job, pos, 1 - player, plies - 1);
+        positionUndo(pos, col);
+        if (!ok)
+            return 0;
+    }
+    return 1;
+}
+
+void *bookWorker(void *arg){
+    //searches the records one at a time; every worker has its own context and table
+    BookJob *job = arg;
+    SearchContext ctx;
+    searchContextInit(&ctx, job->engine, job->records[0].pos.cols, job->records[0].pos.connectN);
+
+    while (1){
+        long long index = atomic_fetch_add(&job->nextRecord, 1);
+        if (index >= job->count)
+            break;
+        BookRecord *record = &job->records[index];
+        Position pos = record->pos;
+        SearchResult result = searchBestMove(&pos, pos.moveCount & 1, &ctx);
+
+        int mirrored;
+        positionCanonicalKey(&pos, &mirrored);
+        int move = mirrored ? pos.cols - 1 - result.move : result.move;
+        record->entry = (uint32_t)(uint16_t)result.score | (uint32_t)move << 16 | (uint32_t)result.depth << 24;
+    }
+
+    searchContextFree(&ctx);
+    countersFlush();
+    return NULL;
+}
+
+int compareBookRecords(const void *a, const void *b){
+    uint64_t keyA = ((const BookRecord *)a)->key;
+    uint64_t keyB = ((const BookRecord *)b)->key;
+    return (keyA > keyB) - (keyA < keyB);
+}
+
+int writeBook(const char *path, const BookRecord *records, long long count, const BoardOptions *board, int plies){
+    //records must already be sorted by key
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+        return 0;
+
+    BookHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BOOK_MAGIC, sizeof(header.magic));
+    header.rows = board->rows;
+    header.cols = board->cols;
+    header.connectN = board->connectN;
+    header.plies = plies;
+    header.count = (uint64_t)count;
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (long long i = 0; ok && i < count; i++)
+        ok = fwrite(&records[i].key, sizeof(uint64_t), 1, file) == 1;
+    for (long long i = 0; ok && i < count; i++)
+        ok = fwrite(&records[i].entry, sizeof(uint32_t), 1, file) == 1;
+    return fclose(file) == 0 && ok;
+}
+
+int runMakeBook(const EngineOptions *engine, const BookOptions *bookOptions, const BatchOptions *batch, const BoardOptions *board){
+    //collects every position with at most bookOptions->plies tokens (mirrors folded together),
+    //searches them on a pool of workers and writes the book sorted by key
+    EngineOptions options = *engine;
+    options.aiMode = AI_SEARCH;
+    options.book = NULL;
+
+    BookJob job;
+    job.engine = &options;
+    job.records = NULL;
+    job.count = 0;
+    job.capacity = 0;
+    job.slots = NULL;
+    job.slotMask = 0;
+    atomic_init(&job.nextRecord, 0);
+
+    Position pos;
+    positionInit(&pos, board->rows, board->cols, board->connectN);
+    long long start = monotonicNanos();
+    if (!bookCollect(&job, &pos, 0, bookOptions->plies)){
+        fprintf(stderr, "Out of memory collecting book positions.\n");
+        free(job.records);
+        free(job.slots);
+        return 0;
+    }
+    free(job.slots);
+    job.slots = NULL;
+
+    int threads = workerThreadCount(batch->threads);
+    pthread_t *workers = malloc((size_t)threads * sizeof(pthread_t));
+    int started = 0;
+    for (; workers != NULL && started < threads; started++){
+        if (pthread_create(&workers[started], NULL, bookWorker, &job) != 0)
+            break;
+    }
+    if (started == 0)
+        bookWorker(&job);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+
+    qsort(job.records, (size_t)job.count, sizeof(BookRecord), compareBookRecords);
+    int ok = writeBook(bookOptions->path, job.records, job.count, board, bookOptions->plies);
+    double seconds = (monotonicNanos() - start) / 1e9;
+    if (ok)
+        fprintf(stderr, "%lld book positions up to %d plies searched on %d threads in %.3f s, written to %s\n",
+                job.count, bookOptions->plies, started ? started : 1, seconds, bookOptions->path);
+    else
+        fprintf(stderr, "Cannot write book %s.\n", bookOptions->path);
+    free(job.records);
+    return ok;
+}
+
+/* Server protocol, one command per line, answers go to the client that sent it:
+     new [h|c] [h|c]   start a game, players human or computer (default h c)
+                       -> game ID
+     play ID COL       a human move, columns counted from 1
+     board ID          -> board ID ROWS, the rows from the top, separated by '/'
+     end ID            -> ended ID
+     games             -> games LIVE BUSY, all games of the server and those at the workers
+     shutdown          stop the server
+   every move, human or computer, is announced as "move ID COL PLAYER" and the end of a
+   game as "over ID WINNER" (0 for a draw); a bad command gets "error MESSAGE". */
+
+void defaultEndgameOptions(EndgameOptions *endgameOptions){
+    endgameOptions->path = NULL;
+    endgameOptions->cells = DEFAULT_ENDGAME_CELLS;
+}
+
+int parseEndgameOption(EndgameOptions *endgameOptions, const char *arg){
+    //same contract as parseEngineOption
+    if (strncmp(arg, "--make-endgame=", 15) == 0){
+        endgameOptions->path = arg + 15;
+        return arg[15] != '\0';
+    }
+    if (strncmp(arg, "--endgame-cells=", 16) == 0){
+        endgameOptions->cells = atoi(arg + 16);
+        return endgameOptions->cells > 0 && endgameOptions->cells <= MAX_ENDGAME_CELLS;
+    }
+    return 0;
+}
+
+uint64_t endgameSlot(uint64_t key, uint32_t displacement, uint64_t slots){
+    return mix64(key + (displacement + 1ULL) * ENDGAME_STEP) % slots;
+}
+
+int endgameOpen(EndgameTable *table, const char *path, const BoardOptions *board){
+    //maps the database and checks that it was made for this board, like bookOpen
+    int fd = open(path, O_RDONLY);
+    if (fd < 0){
+        fprintf(stderr, "Cannot open endgame database %s.\n", path);
+        return 0;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(EndgameHeader)){
+        fprintf(stderr, "%s is not an endgame database.\n", path);
+        close(fd);
+        return 0;
+    }
+    table->size = (size_t)info.st_size;
+    table->map = mmap(NULL, table->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (table->map == MAP_FAILED){
+        fprintf(stderr, "Cannot map endgame database %s.\n", path);
+        return 0;
+    }
+
+    table->header = table->map;
+    uint64_t buckets = table->header->buckets;
+    uint64_t slots = table->header->slots;
+    size_t available = table->size - sizeof(EndgameHeader);
+    if (memcmp(table->header->magic, ENDGAME_MAGIC, sizeof(table->header->magic)) != 0
+        || buckets == 0 || buckets % 2 != 0 || slots == 0 || table->header->count > slots
+        || buckets > available / sizeof(uint32_t) || slots > available / (sizeof(uint64_t) + sizeof(uint32_t))
+        || sizeof(EndgameHeader) + buckets * sizeof(uint32_t) + slots * (sizeof(uint64_t) + sizeof(uint32_t)) != table->size){
+        fprintf(stderr, "%s is not an endgame database.\n", path);
+        endgameClose(table);
+        return 0;
+    }
+    if (table->header->rows != board->rows || table->header->cols != board->cols
+        || table->header->connectN != board->connectN){
+        fprintf(stderr, "Endgame database %s was made for %d rows x %d cols, connect %d.\n", path,
+                table->header->rows, table->header->cols, table->header->connectN);
+        endgameClose(table);
+        return 0;
+    }
+    table->displacements = (const uint32_t *)(table->header + 1);
+    table->keys = (const uint64_t *)(table->displacements + buckets);
+    table->entries = (const uint32_t *)(table->keys + slots);
+    return 1;
+}
+
+void endgameClose(EndgameTable *table){
+    munmap(table->map, table->size);
+    table->map = NULL;
+}
+
+int endgameProbe(const EndgameTable *table, const Position *pos, int *score){
+    //returns the perfect move for the side to move and its exact score, or -1 if pos is not
+    //in the database. two reads whatever the size: the displacement, then the slot.
+    const EndgameHeader *header = table->header;
+    if (pos->rows * pos->cols - pos->moveCount > header->cells)
+        return -1;
+
+    int mirrored;
+    uint64_t key = positionCanonicalKey(pos, &mirrored);
+    uint64_t slot = endgameSlot(key, table->displacements[mix64(key) % header->buckets], header->slots);
+    if (table->keys[slot] != key)
+        return -1;
+
+    uint32_t entry = table->entries[slot];
+    int move = (int)((entry >> 16) & 0xFF);
+    if (mirrored)
+        move = pos->cols - 1 - move;
+    //a damaged file or a key collision must never make an illegal move
+    if (move < 0 || move >= pos->cols || !positionCanPlay(pos, move))
+        return -1;
+    *score = (int16_t)(uint16_t)entry;
+    return move;
+}
+
+const EndgameRecord *endgameMemoFind(const EndgameMemo *memo, uint64_t key){
+    if (memo->slots == NULL)
+        return NULL;
+    uint64_t slot = key & memo->mask;
+    while (memo->slots[slot].key != 0){
+        if (memo->slots[slot].key == key)
+            return &memo->slots[slot];
+        slot = (slot + 1) & memo->mask;
+    }
+    return NULL;
+}
+
+int endgameMemoAdd(EndgameMemo *memo, uint64_t key, uint32_t entry){
+    //adds a key that is not there yet, returns 0 without memory
+    if ((uint64_t)(memo->count + 1) * 2 > (memo->slots == NULL ? 0 : memo->mask + 1)){
+        uint64_t slotCount = memo->slots == NULL ? 1 << 16 : (memo->mask + 1) * 2;
+        EndgameRecord *slots = calloc(slotCount, sizeof(EndgameRecord));
+        if (slots == NULL)
+            return 0;
+        for (uint64_t i = 0; memo->slots != NULL && i <= memo->mask; i++){
+            if (memo->slots[i].key == 0)
+                continue;
+            uint64_t slot = memo->slots[i].key & (slotCount - 1);
+            while (slots[slot].key != 0)
+                slot = (slot + 1) & (slotCount - 1);
+            slots[slot] = memo->slots[i];
+        }
+        free(memo->slots);
+        memo->slots = slots;
+        memo->mask = slotCount - 1;
+    }
+
+    uint64_t slot = key & memo->mask;
+    while (memo->slots[slot].key != 0)
+        slot = (slot + 1) & memo->mask;
+    memo->slots[slot].key = key;
+    memo->slots[slot].entry = entry;
+    memo->count++;
+    return 1;
+}
+
+int endgameSolve(Position *pos, int player, const int order[MAX_COLS], EndgameMemo *memo){
+    //the exact score of pos for player, as solveNegamax gives it at ply 0, found by going
+    //through every move; every position on the way is added to memo with its best move.
+    //returns INF_SCORE if memory ran out.
+    int mirrored;
+    uint64_t key = positionCanonicalKey(pos, &mirrored);
+    const EndgameRecord *known = endgameMemoFind(memo, key);
+    if (known != NULL)
+        return (int16_t)(uint16_t)known->entry;
+
+    Bitboard wins[2];
+    positionWinningCells(pos, pos->connectN, wins);
+    Bitboard playable = positionPlayableCells(pos);
+    int best = WIN_SCORE - 1;
+    int bestMove = firstColumnIn(pos, wins[player] & playable, order);
+    if (bestMove == -1){
+        //no move wins, so a move either fills the board or leads to a position to solve
+        best = -INF_SCORE;
+        for (int i = 0; i < pos->cols; i++){
+            int col = order[i];
+            if (!positionCanPlay(pos, col))
+                continue;
+            int value = 0;
+            positionPlay(pos, player, col);
+            if (!positionIsFull(pos))
+                value = endgameSolve(pos, 1 - player, order, memo);
+            positionUndo(pos, col);
+            if (value == INF_SCORE)
+                return INF_SCORE;
+
+            //a win or a loss one ply further away, seen from the other side
+            value = -(value > 0 ? value - 1 : (value < 0 ? value + 1 : 0));
+            if (value > best){
+                best = value;
+                bestMove = col;
+            }
+        }
+    }
+
+    int move = mirrored ? pos->cols - 1 - bestMove : bestMove;
+    if (!endgameMemoAdd(memo, key, (uint32_t)(uint16_t)best | (uint32_t)move << 16))
+        return INF_SCORE;
+    return best;
+}
+
+void *endgameWorker(void *arg){
+    //plays seed games like the batch and solves the first position of each game that is down
+    //to job->cells empty cells; the seeds overlap a lot, so they share the worker's memo
+    EndgameWorker *worker = arg;
+    EndgameJob *job = worker->job;
+    const BoardOptions *board = job->board;
+    int seedPly = board->rows * board->cols - job->cells;
+    Position pos;
+    GameRecord record;
+    SearchContext contexts[2];
+    searchContextInit(&contexts[0], job->engine, board->cols, board->connectN);
+    searchContextInit(&contexts[1], job->engine, board->cols, board->connectN);
+
+    while (!atomic_load(&job->failed)){
+        long long game = atomic_fetch_add(&job->nextGame, 1);
+        if (game >= job->games)
+            break;
+        uint64_t rngState = mix64(job->batch->seed ^ mix64((uint64_t)game + 1));
+        //fresh tables per seed game, so the seeds for a --seed do not depend on --threads
+        searchContextReset(&contexts[0]);
+        searchContextReset(&contexts[1]);
+        playSelfPlayGame(&pos, board, contexts, rngState, job->batch->randomPlies, &record);
+        if (record.length <= seedPly)
+            continue;
+
+        positionInit(&pos, board->rows, board->cols, board->connectN);
+        for (int i = 0; i < seedPly; i++)
+            positionPlay(&pos, i & 1, record.moves[i]);
+        atomic_fetch_add(&job->seeds, 1);
+        if (endgameSolve(&pos, seedPly & 1, contexts[0].order, &worker->memo) == INF_SCORE)
+            atomic_store(&job->failed, 1);
+    }
+
+    searchContextFree(&contexts[0]);
+    searchContextFree(&contexts[1]);
+    countersFlush();
+    return NULL;
+}
+
+int compareEndgameRecords(const void *a, const void *b){
+    uint64_t keyA = ((const EndgameRecord *)a)->key;
+    uint64_t keyB = ((const EndgameRecord *)b)->key;
+    return (keyA > keyB) - (keyA < keyB);
+}
+
+int buildEndgameHash(const EndgameRecord *records, long long count, uint64_t buckets, uint64_t slots, uint32_t displacements[], uint64_t keys[], uint32_t entries[]){
+    //hash and displace: the buckets are placed largest first, each one trying displacements
+    //until all of its keys land on free slots. records must be free of duplicates.
+    //returns 0 if memory ran out or a bucket found no place.
+    long long *bucketStart = calloc(buckets + 1, sizeof(long long));
+    long long *members = malloc((size_t)(count ? count : 1) * sizeof(long long));
+    uint64_t *bucketOrder = malloc(buckets * sizeof(uint64_t));
+    uint8_t *used = calloc(slots, 1);
+    int ok = bucketStart != NULL && members != NULL && bucketOrder != NULL && used != NULL;
+
+    //counting sort of the records by bucket, then of the buckets by size
+    int largest = 0;
+    for (long long i = 0; ok && i < count; i++)
+        bucketStart[mix64(records[i].key) % buckets + 1]++;
+    for (uint64_t b = 0; ok && b < buckets; b++){
+        if (bucketStart[b + 1] > largest)
+            largest = (int)bucketStart[b + 1];
+        bucketStart[b + 1] += bucketStart[b];
+    }
+    for (long long i = 0; ok && i < count; i++){
+        uint64_t b = mix64(records[i].key) % buckets;
+        members[bucketStart[b]++] = i;
+    }
+    for (uint64_t b = buckets; ok && b > 0; b--)
+        bucketStart[b] = bucketStart[b - 1];
+    if (ok)
+        bucketStart[0] = 0;
+    uint64_t ordered = 0;
+    for (int size = largest; ok && size > 0; size--){
+        for (uint64_t b = 0; b < buckets; b++){
+            if (bucketStart[b + 1] - bucketStart[b] == size)
+                bucketOrder[ordered++] = b;
+        }
+    }
+
+    for (uint64_t b = 0; ok && b < buckets; b++)
+        displacements[b] = 0;
+    for (uint64_t i = 0; ok && i < slots; i++){
+        keys[i] = 0;
+        entries[i] = 0xFFu << 16;
+    }
+    for (uint64_t o = 0; ok && o < ordered; o++){
+        uint64_t b = bucketOrder[o];
+        const long long *bucket = &members[bucketStart[b]];
+        int size = (int)(bucketStart[b + 1] - bucketStart[b]);
+        uint64_t taken[MAX_CELLS];
+        uint32_t displacement = 0;
+        int placed = 0;
+        for (; size <= MAX_CELLS && displacement < UINT32_MAX; displacement++){
+            placed = 1;
+            for (int k = 0; placed && k < size; k++){
+                taken[k] = endgameSlot(records[bucket[k]].key, displacement, slots);
+                if (used[taken[k]])
+                    placed = 0;
+                for (int j = 0; placed && j < k; j++)
+                    placed = taken[j] != taken[k];
+            }
+            if (placed)
+                break;
+        }
+        if (!placed){
+            ok = 0;
+            break;
+        }
+        displacements[b] = displacement;
+        for (int k = 0; k < size; k++){
+            used[taken[k]] = 1;
+            keys[taken[k]] = records[bucket[k]].key;
+            entries[taken[k]] = records[bucket[k]].entry;
+        }
+    }
+
+    free(bucketStart);
+    free(members);
+    free(bucketOrder);
+    free(used);
+    return ok;
+}
+
+int writeEndgame(const char *path, const EndgameRecord *records, long long count, const BoardOptions *board, int cells){
+    //records must be sorted by key without duplicates
+    EndgameHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ENDGAME_MAGIC, sizeof(header.magic));
+    header.rows = board->rows;
+    header.cols = board->cols;
+    header.connectN = board->connectN;
+    header.cells = cells;
+    header.count = (uint64_t)count;
+    header.buckets = ((uint64_t)count / ENDGAME_BUCKET_KEYS + 2) & ~1ULL;
+    header.slots = (uint64_t)count + (uint64_t)count / 4 + 1;  //at most 80% full
+
+    uint32_t *displacements = malloc(header.buckets * sizeof(uint32_t));
+    uint64_t *keys = malloc(header.slots * sizeof(uint64_t));
+    uint32_t *entries = malloc(header.slots * sizeof(uint32_t));
+    int ok = displacements != NULL && keys != NULL && entries != NULL
+          && buildEndgameHash(records, count, header.buckets, header.slots, displacements, keys, entries);
+
+    FILE *file = ok ? fopen(path, "wb") : NULL;
+    if (file != NULL){
+        ok = fwrite(&header, sizeof(header), 1, file) == 1
+          && fwrite(displacements, sizeof(uint32_t), header.buckets, file) == header.buckets
+          && fwrite(keys, sizeof(uint64_t), header.slots, file) == header.slots
+          && fwrite(entries, sizeof(uint32_t), header.slots, file) == header.slots;
+        ok = fclose(file) == 0 && ok;
+    }
+    free(displacements);
+    free(keys);
+    free(entries);
+    return file != NULL && ok;
+}
+
+int runMakeEndgame(const EngineOptions *engine, const EndgameOptions *endgameOptions, const BatchOptions *batch, const BoardOptions *board){
+    //forward enumeration from the late positions of self-play games: every worker solves its
+    //seeds exactly into its own memo, then the memos are merged and written with a perfect hash
+    if (endgameOptions->cells >= board->rows * board->cols){
+        fprintf(stderr, "An endgame database needs fewer than %d empty cells.\n", board->rows * board->cols);
+        return 0;
+    }
+    EngineOptions options = *engine;
+    options.book = NULL;
+    options.endgame = NULL;
+
+    EndgameJob job;
+    job.engine = &options;
+    job.batch = batch;
+    job.board = board;
+    job.cells = endgameOptions->cells;
+    job.games = batch->games > 0 ? batch->games : DEFAULT_ENDGAME_GAMES;
+    atomic_init(&job.nextGame, 0);
+    atomic_init(&job.seeds, 0);
+    atomic_init(&job.failed, 0);
+
+    long long start = monotonicNanos();
+    int threads = workerThreadCount(batch->threads);
+    EndgameWorker *workers = calloc((size_t)threads, sizeof(EndgameWorker));
+    int started = 0;
+    for (; workers != NULL && started < threads; started++){
+        workers[started].job = &job;
+        if (pthread_create(&workers[started].thread, NULL, endgameWorker, &workers[started]) != 0)
+            break;
+    }
+    EndgameWorker alone;
+    memset(&alone, 0, sizeof(alone));
+    alone.job = &job;
+    if (started == 0)
+        endgameWorker(&alone);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    //the workers' memos, merged; positions several workers reached were solved alike
+    long long total = alone.memo.count;
+    for (int i = 0; i < started; i++)
+        total += workers[i].memo.count;
+    EndgameRecord *records = atomic_load(&job.failed) ? NULL : malloc((size_t)(total ? total : 1) * sizeof(EndgameRecord));
+    long long count = 0;
+    for (int w = -1; w < started; w++){
+        EndgameMemo *memo = w < 0 ? &alone.memo : &workers[w].memo;
+        for (uint64_t i = 0; records != NULL && memo->slots != NULL && i <= memo->mask; i++){
+            if (memo->slots[i].key != 0)
+                records[count++] = memo->slots[i];
+        }
+        free(memo->slots);
+    }
+    free(workers);
+    if (records == NULL){
+        fprintf(stderr, "Out of memory solving endgame positions.\n");
+        return 0;
+    }
+    qsort(records, (size_t)count, sizeof(EndgameRecord), compareEndgameRecords);
+    long long unique = 0;
+    for (long long i = 0; i < count; i++){
+        if (unique == 0 || records[i].key != records[unique - 1].key)
+            records[unique++] = records[i];
+    }
+    double solveSeconds = (monotonicNanos() - start) / 1e9;
+
+    int ok = writeEndgame(endgameOptions->path, records, unique, board, endgameOptions->cells);
+    double seconds = (monotonicNanos() - start) / 1e9;
+    if (ok)
+        fprintf(stderr, "%lld endgame positions with at most %d empty cells from %lld of %lld games, "
+                "solved on %d threads in %.3f s, hashed and written to %s in %.3f s\n",
+                unique, endgameOptions->cells, (long long)atomic_load(&job.seeds), job.games,
+                started ? started : 1, solveSeconds, endgameOptions->path, seconds - solveSeconds);
+    else
+        fprintf(stderr, "Cannot write endgame database %s.\n", endgameOptions->path);
+    free(records);
+    return ok;
+}
+
+void gamePoolInit(GamePool *pool){
+    pool->chunks = NULL;
+    pool->chunkCount = 0;
+    pool->freeList = -1;
+    pool->live = 0;
+}
+
+void gamePoolFree(GamePool *pool){
+    for (int i = 0; i < pool->chunkCount; i++)
+        free(pool->chunks[i]);
+    free(pool->chunks);
+    pool->chunks = NULL;
+    pool->chunkCount = 0;
+    pool->freeList = -1;
+}
+
+ServerGame *gamePoolAlloc(GamePool *pool){
+    //takes a slot off the free list, adding a chunk when it is empty.
+    //returns NULL when the memory or the ids run out.
+    if (pool->freeList == -1){
+        int first = pool->chunkCount * GAME_POOL_CHUNK;
+        if (first + GAME_POOL_CHUNK > SERVER_MAX_GAMES)
+            return NULL;
+        ServerGame **chunks = realloc(pool->chunks, (size_t)(pool->chunkCount + 1) * sizeof(ServerGame *));
+        if (chunks == NULL)
+            return NULL;
+        pool->chunks = chunks;
+        ServerGame *chunk = malloc(GAME_POOL_CHUNK * sizeof(ServerGame));
+        if (chunk == NULL)
+            return NULL;
+        pool->chunks[pool->chunkCount++] = chunk;
+        for (int i = GAME_POOL_CHUNK - 1; i >= 0; i--){
+            chunk[i].index = first + i;
+            chunk[i].generation = 0;
+            chunk[i].client = -1;
+            chunk[i].nextFree = pool->freeList;
+            pool->freeList = first + i;
+        }
+    }
+    ServerGame *game = &pool->chunks[pool->freeList / GAME_POOL_CHUNK][pool->freeList % GAME_POOL_CHUNK];
+    pool->freeList = game->nextFree;
+    pool->live++;
+    return game;
+}
+
+void gamePoolRelease(GamePool *pool, ServerGame *game){
+    //the slot's next use gets a new id, so an old id cannot reach it
+    game->client = -1;
+    game->generation++;
+    game->nextFree = pool->freeList;
+    pool->freeList = game->index;
+    pool->live--;
+}
+
+ServerGame *gamePoolFind(GamePool *pool, unsigned long long id){
+    //the live game with this id, NULL for none
+    unsigned long long index = id & (SERVER_MAX_GAMES - 1);
+    if (index >= (unsigned long long)pool->chunkCount * GAME_POOL_CHUNK)
+        return NULL;
+    ServerGame *game = &pool->chunks[index / GAME_POOL_CHUNK][index % GAME_POOL_CHUNK];
+    if (game->client == -1 || game->ended || gameId(game) != id)
+        return NULL;
+    return game;
+}
+
+unsigned long long gameId(const ServerGame *game){
+    return (unsigned long long)game->generation << GAME_INDEX_BITS | (unsigned long long)game->index;
+}
+
+void *serverWorker(void *arg){
+    //chooses computer moves for the games on the job list, each worker with its own context
+    GameServer *server = arg;
+    SearchContext ctx;
+    searchContextInit(&ctx, server->engine, server->board->cols, server->board->connectN);
+
+    pthread_mutex_lock(&server->lock);
+    while (1){
+        while (server->jobHead == NULL && !server->stopping)
+            pthread_cond_wait(&server->jobReady, &server->lock);
+        if (server->stopping)
+            break;
+        ServerGame *game = server->jobHead;
+        server->jobHead = game->nextJob;
+        if (server->jobHead == NULL)
+            server->jobTail = NULL;
+        pthread_mutex_unlock(&server->lock);
+
+        //the search plays on its own copy, so the event loop can still read the game
+        Position pos = game->pos;
+        game->aiMove = computerPlayerMove(&pos, game->player, &ctx);
+
+        pthread_mutex_lock(&server->lock);
+        game->nextJob = server->finished;
+        server->finished = game;
+        //a full pipe already holds a wake up, so a failed write loses nothing
+        if (write(server->wakeFds[1], "", 1) < 0){}
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    searchContextFree(&ctx);
+    countersFlush();
+    return NULL;
+}
+
+void clientPrintf(ServerClient *client, const char *format, ...){
+    //queues a line for the client. commands and moves wait while the client is above
+    //SERVER_HIGH_WATER, so the buffer only overflows if one line does not fit; the client
+    //then loses its output and is closed.
+    if (client->inFd == -1 || client->outputLength < 0)
+        return;
+    va_list args;
+    va_start(args, format);
+    int room = SERVER_OUTPUT - client->outputLength;
+    int length = vsnprintf(client->output + client->outputLength, (size_t)room, format, args);
+    va_end(args);
+    if (length < 0 || length >= room)
+        client->outputLength = -1;
+    else
+        client->outputLength += length;
+}
+
+int clientFlush(ServerClient *client){
+    //writes as much queued output as the descriptor takes, returns 0 if the client is gone
+    if (client->outputLength < 0)
+        return 0;
+    int sent = 0;
+    while (sent < client->outputLength){
+        ssize_t n = client->outFd == STDOUT_FILENO
+                  ? write(client->outFd, client->output + sent, (size_t)(client->outputLength - sent))
+                  : send(client->outFd, client->output + sent, (size_t)(client->outputLength - sent), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            break;  //the rest goes out when the descriptor is writable again
+        if (n <= 0)
+            return 0;
+        sent += (int)n;
+    }
+    memmove(client->output, client->output + sent, (size_t)(client->outputLength - sent));
+    client->outputLength -= sent;
+    return 1;
+}
+
+void serverCloseClient(GameServer *server, int clientIndex){
+    //ends every game of the client, a game at a worker is freed once it comes back
+    GamePool *pool = &server->pool;
+    for (int i = 0; i < pool->chunkCount * GAME_POOL_CHUNK; i++){
+        ServerGame *game = &pool->chunks[i / GAME_POOL_CHUNK][i % GAME_POOL_CHUNK];
+        if (game->client != clientIndex || game->ended)
+            continue;
+        if (game->busy)
+            game->ended = 1;
+        else
+            gamePoolRelease(pool, game);
+    }
+    ServerClient *client = &server->clients[clientIndex];
+    if (client->inFd != STDIN_FILENO)
+        close(client->inFd);
+    client->inFd = -1;
+    client->outFd = -1;
+}
+
+void serverStartTurn(GameServer *server, ServerGame *game){
+    //queues the game for the workers when a computer is to move
+    if (game->over || game->types[game->player] != COMPUTER)
+        return;
+    game->busy = 1;
+    game->nextJob = NULL;
+    server->busyGames++;
+    pthread_mutex_lock(&server->lock);
+    if (server->jobTail != NULL)
+        server->jobTail->nextJob = game;
+    else
+        server->jobHead = game;
+    server->jobTail = game;
+    pthread_cond_signal(&server->jobReady);
+    pthread_mutex_unlock(&server->lock);
+}
+
+void serverPlayMove(GameServer *server, ServerGame *game, int col){
+    //plays a checked move, announces it and whatever it ends, then starts the next turn
+    ServerClient *client = &server->clients[game->client];
+    unsigned long long id = gameId(game);
+    positionPlay(&game->pos, game->player, col);
+    clientPrintf(client, "move %llu %d %d\n", id, col + 1, game->player + 1);
+    if (positionMoveMakesSequence(&game->pos, game->player, col, game->pos.connectN)){
+        game->over = 1;
+        clientPrintf(client, "over %llu %d\n", id, game->player + 1);
+    }
+    else if (positionIsFull(&game->pos)){
+        game->over = 1;
+        clientPrintf(client, "over %llu 0\n", id);
+    }
+    game->player = 1 - game->player;
+    serverStartTurn(server, game);
+}
+
+void serverCollectMoves(GameServer *server){
+    //takes back the games the workers are done with and plays their moves. a game whose
+    //client is behind on output stays parked, busy, until the client catches up.
+    char drain[256];
+    while (read(server->wakeFds[0], drain, sizeof(drain)) > 0){}
+
+    pthread_mutex_lock(&server->lock);
+    ServerGame *game = server->finished;
+    server->finished = NULL;
+    pthread_mutex_unlock(&server->lock);
+    while (game != NULL){
+        ServerGame *next = game->nextJob;
+        game->nextJob = server->parked;
+        server->parked = game;
+        game = next;
+    }
+
+    ServerGame **link = &server->parked;
+    while (*link != NULL){
+        game = *link;
+        if (!game->ended && server->clients[game->client].outputLength > SERVER_HIGH_WATER){
+            link = &game->nextJob;
+            continue;
+        }
+        *link = game->nextJob;
+        game->busy = 0;
+        server->busyGames--;
+        if (game->ended)
+            gamePoolRelease(&server->pool, game);
+        else
+            serverPlayMove(server, game, game->aiMove);
+    }
+}
+
+void serverHandleLine(GameServer *server, int clientIndex, char *line){
+    ServerClient *client = &server->clients[clientIndex];
+    char command[16];
+    unsigned long long id;
+    int col;
+    if (sscanf(line, "%15s", command) != 1)
+        return;  //empty line
+
+    if (strcmp(command, "new") == 0){
+        char types[2][8] = {"h", "c"};
+        sscanf(line, "%*s %7s %7s", types[0], types[1]);
+        for (int i = 0; i < 2; i++){
+            if (strcmp(types[i], "h") != 0 && strcmp(types[i], "c") != 0){
+                clientPrintf(client, "error player types are h or c\n");
+                return;
+            }
+        }
+        ServerGame *game = gamePoolAlloc(&server->pool);
+        if (game == NULL){
+            clientPrintf(client, "error no room for another game\n");
+            return;
+        }
+        positionInit(&game->pos, server->board->rows, server->board->cols, server->board->connectN);
+        game->client = clientIndex;
+        game->types[0] = types[0][0] == 'h' ? HUMAN : COMPUTER;
+        game->types[1] = types[1][0] == 'h' ? HUMAN : COMPUTER;
+        game->player = 0;
+        game->busy = 0;
+        game->ended = 0;
+        game->over = 0;
+        clientPrintf(client, "game %llu\n", gameId(game));
+        serverStartTurn(server, game);
+        return;
+    }
+    if (strcmp(command, "games") == 0){
+        clientPrintf(client, "games %d %d\n", server->pool.live, server->busyGames);
+        return;
+    }
+    if (strcmp(command, "shutdown") == 0){
+        server->shutdown = 1;
+        return;
+    }
+    if (strcmp(command, "play") != 0 && strcmp(command, "board") != 0 && strcmp(command, "end") != 0){
+        clientPrintf(client, "error unknown command %s\n", command);
+        return;
+    }
+
+    //the rest name a game of this client
+    ServerGame *game = NULL;
+    if (sscanf(line, "%*s %llu", &id) == 1)
+        game = gamePoolFind(&server->pool, id);
+    if (game == NULL || game->client != clientIndex){
+        clientPrintf(client, "error no such game\n");
+        return;
+    }
+    if (strcmp(command, "end") == 0){
+        if (game->busy)
+            game->ended = 1;
+        else
+            gamePoolRelease(&server->pool, game);
+        clientPrintf(client, "ended %llu\n", id);
+        return;
+    }
+    if (strcmp(command, "board") == 0){
+        //the worker only ever reads the game's position, so it can be shown at any time
+        char rows[MAX_ROWS * (MAX_COLS + 1)];
+        int length = 0;
+        for (int row = game->pos.rows - 1; row >= 0; row--){
+            for (int c = 0; c < game->pos.cols; c++){
+                Bitboard cell = positionCellBit(&game->pos, row, c);
+                rows[length++] = (game->pos.tokens[0] & cell) ? TOKEN_P1 : ((game->pos.tokens[1] & cell) ? TOKEN_P2 : EMPTY);
+            }
+            rows[length++] = row > 0 ? '/' : '\0';
+        }
+        clientPrintf(client, "board %llu %s\n", id, rows);
+        return;
+    }
+
+    if (sscanf(line, "%*s %*u %d", &col) != 1){
+        clientPrintf(client, "error usage: play ID COL\n");
+        return;
+    }
+    if (game->over || game->busy || game->types[game->player] != HUMAN){
+        clientPrintf(client, "error not a human move in game %llu\n", id);
+        return;
+    }
+    if (!positionCanPlay(&game->pos, col - 1)){
+        clientPrintf(client, "error column %d cannot be played\n", col);
+        return;
+    }
+    serverPlayMove(server, game, col - 1);
+}
+
+void serverRunLines(GameServer *server, int clientIndex){
+    //runs the complete lines waiting in the client's input while it keeps up with its output
+    ServerClient *client = &server->clients[clientIndex];
+    int start = 0;
+    while (client->inFd != -1 && client->outputLength >= 0 && client->outputLength <= SERVER_HIGH_WATER){
+        char *newline = memchr(client->input + start, '\n', (size_t)(client->inputLength - start));
+        if (newline == NULL)
+            break;
+        *newline = '\0';
+        if (client->skipping || newline - (client->input + start) >= SERVER_LINE)
+            clientPrintf(client, "error line longer than %d characters\n", SERVER_LINE - 1);
+        else
+            serverHandleLine(server, clientIndex, client->input + start);
+        client->skipping = 0;
+        start = (int)(newline - client->input) + 1;
+    }
+    memmove(client->input, client->input + start, (size_t)(client->inputLength - start));
+    client->inputLength -= start;
+    if (client->inputLength == SERVER_INPUT && memchr(client->input, '\n', SERVER_INPUT) == NULL){
+        //a full buffer without a newline: the rest of that line is dropped as it comes
+        client->inputLength = 0;
+        client->skipping = 1;
+    }
+}
+
+int serverReadClient(GameServer *server, int clientIndex){
+    //reads what the client sent and runs every complete line, returns 0 at its end
+    ServerClient *client = &server->clients[clientIndex];
+    ssize_t n = read(client->inFd, client->input + client->inputLength, (size_t)(SERVER_INPUT - client->inputLength));
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 1;
+    if (n <= 0)
+        return 0;
+    client->inputLength += (int)n;
+    serverRunLines(server, clientIndex);
+    return 1;
+}
+
+void clientReset(ServerClient *client, int inFd, int outFd){
+    client->inFd = inFd;
+    client->outFd = outFd;
+    client->inputLength = 0;
+    client->skipping = 0;
+    client->inputClosed = 0;
+    client->outputLength = 0;
+}
+
+int serverAccept(GameServer *server){
+    //takes a new connection into a free client slot, returns 0 if it had to be refused
+    int fd = accept(server->listenFd, NULL, NULL);
+    if (fd < 0)
+        return 0;
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++){
+        ServerClient *client = &server->clients[i];
+        if (client->inFd != -1)
+            continue;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        clientReset(client, fd, fd);
+        return 1;
+    }
+    close(fd);
+    return 0;
+}
+
+int runServer(const EngineOptions *engine, const BatchOptions *batch, const BoardOptions *board, const char *socketPath){
+    //one thread runs the event loop: it reads commands, owns the games and writes answers;
+    //computer moves go to a pool of --threads workers and come back through a pipe that
+    //wakes the loop. with socketPath it listens on a Unix socket, otherwise it serves stdin.
+    GameServer *server = malloc(sizeof(GameServer));
+    if (server == NULL){
+        fprintf(stderr, "Out of memory for the server.\n");
+        return 0;
+    }
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++)
+        server->clients[i].inFd = -1;
+    gamePoolInit(&server->pool);
+    server->listenFd = -1;
+    server->jobHead = NULL;
+    server->jobTail = NULL;
+    server->finished = NULL;
+    server->parked = NULL;
+    server->stopping = 0;
+    server->busyGames = 0;
+    server->shutdown = 0;
+    server->engine = engine;
+    server->board = board;
+    if (pipe(server->wakeFds) != 0){
+        fprintf(stderr, "Cannot create the server's wake up pipe.\n");
+        free(server);
+        return 0;
+    }
+    fcntl(server->wakeFds[0], F_SETFL, fcntl(server->wakeFds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(server->wakeFds[1], F_SETFL, fcntl(server->wakeFds[1], F_GETFL) | O_NONBLOCK);
+
+    int ok = 1;
+    if (socketPath != NULL){
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        server->listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        ok = strlen(socketPath) < sizeof(address.sun_path) && server->listenFd >= 0;
+        if (ok){
+            strcpy(address.sun_path, socketPath);
+            unlink(socketPath);
+            ok = bind(server->listenFd, (struct sockaddr *)&address, sizeof(address)) == 0
+              && listen(server->listenFd, SERVER_MAX_CLIENTS) == 0;
+        }
+        if (!ok)
+            fprintf(stderr, "Cannot listen on %s.\n", socketPath);
+    }
+    else{
+        clientReset(&server->clients[0], STDIN_FILENO, STDOUT_FILENO);
+    }
+
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->jobReady, NULL);
+    int threads = workerThreadCount(batch->threads);
+    pthread_t *workers = malloc((size_t)threads * sizeof(pthread_t));
+    int started = 0;
+    for (; ok && workers != NULL && started < threads; started++){
+        if (pthread_create(&workers[started], NULL, serverWorker, server) != 0)
+            break;
+    }
+    if (ok && started == 0){
+        fprintf(stderr, "Cannot start the server's workers.\n");
+        ok = 0;
+    }
+
+    struct pollfd fds[SERVER_MAX_CLIENTS + 2];
+    int owners[SERVER_MAX_CLIENTS + 2];  //client of each descriptor, -1 listening, -2 waking
+    while (ok && !server->shutdown){
+        //serving stdin ends once its input is over and its games are back from the workers
+        if (server->listenFd == -1 && server->clients[0].inputClosed && server->busyGames == 0)
+            break;
+
+        int count = 0;
+        fds[count].fd = server->wakeFds[0];
+        fds[count].events = POLLIN;
+        owners[count++] = -2;
+        if (server->listenFd != -1){
+            fds[count].fd = server->listenFd;
+            fds[count].events = POLLIN;
+            owners[count++] = -1;
+        }
+        for (int i = 0; i < SERVER_MAX_CLIENTS; i++){
+            ServerClient *client = &server->clients[i];
+            if (client->inFd == -1)
+                continue;
+            int keepingUp = client->outputLength <= SERVER_HIGH_WATER;
+            short events = !client->inputClosed && keepingUp && client->inputLength < SERVER_INPUT ? POLLIN : 0;
+            if (client->outputLength > 0 && client->outFd != STDOUT_FILENO)
+                events |= POLLOUT;
+            if (events){
+                fds[count].fd = client->inFd;
+                fds[count].events = events;
+                owners[count++] = i;
+            }
+        }
+        if (poll(fds, (nfds_t)count, -1) < 0){
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (int k = 0; k < count; k++){
+            if (!fds[k].revents)
+                continue;
+            if (owners[k] == -2)
+                serverCollectMoves(server);
+            else if (owners[k] == -1)
+                serverAccept(server);
+            else if ((fds[k].revents & (POLLIN | POLLHUP | POLLERR)) && !serverReadClient(server, owners[k])){
+                if (server->clients[owners[k]].inFd == STDIN_FILENO)
+                    server->clients[owners[k]].inputClosed = 1;
+                else
+                    serverCloseClient(server, owners[k]);
+            }
+        }
+        for (int i = 0; i < SERVER_MAX_CLIENTS; i++){
+            ServerClient *client = &server->clients[i];
+            if (client->inFd == -1 || client->outputLength == 0 || clientFlush(client))
+                continue;
+            if (client->inFd == STDIN_FILENO)
+                ok = 0;  //stdout is gone, nobody hears the answers anymore
+            else
+                serverCloseClient(server, i);
+        }
+        //what waited for a client to catch up may go on now
+        if (server->parked != NULL)
+            serverCollectMoves(server);
+        for (int i = 0; i < SERVER_MAX_CLIENTS; i++){
+            ServerClient *client = &server->clients[i];
+            if (client->inFd != -1 && client->inputLength > 0)
+                serverRunLines(server, i);
+        }
+    }
+
+    pthread_mutex_lock(&server->lock);
+    server->stopping = 1;
+    pthread_cond_broadcast(&server->jobReady);
+    pthread_mutex_unlock(&server->lock);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++){
+        if (server->clients[i].inFd != -1 && server->clients[i].inFd != STDIN_FILENO)
+            close(server->clients[i].inFd);
+    }
+    if (server->listenFd != -1){
+        close(server->listenFd);
+        unlink(socketPath);
+    }
+    close(server->wakeFds[0]);
+    close(server->wakeFds[1]);
+    pthread_mutex_destroy(&server->lock);
+    pthread_cond_destroy(&server->jobReady);
+    gamePoolFree(&server->pool);
+    free(workers);
+    free(server);
+    return ok;
+}
+
+void defaultBenchOptions(BenchOptions *bench){
+    bench->enabled = 0;
+    bench->perftDepth = DEFAULT_PERFT_DEPTH;
+    bench->games = DEFAULT_BENCH_GAMES;
+}
+
+int parseBenchOption(BenchOptions *bench, const char *arg){
+    //same contract as parseEngineOption
+    if (strcmp(arg, "--bench") == 0){
+        bench->enabled = 1;
+        return 1;
+    }
+    if (strncmp(arg, "--perft-depth=", 14) == 0){
+        bench->perftDepth = atoi(arg + 14);
+        return bench->perftDepth >= 0 && bench->perftDepth <= MAX_CELLS;
+    }
+    if (strncmp(arg, "--bench-games=", 14) == 0){
+        bench->games = atoi(arg + 14);
+        return bench->games >= 0;
+    }
+    return 0;
+}
+
+long long perftPosition(Position *pos, int player, int depth){
+    //number of move sequences of length depth; a move that ends the game ends its sequence
+    if (depth == 0)
+        return 1;
+
+    long long nodes = 0;
+    for (int col = 0; col < pos->cols; col++){
+        if (!positionCanPlay(pos, col))
+            continue;
+        positionPlay(pos, player, col);
+        if (depth == 1)
+            nodes++;
+        else if (!positionMoveMakesSequence(pos, player, col, pos->connectN) && !positionIsFull(pos))
+            nodes += perftPosition(pos, 1 - player, depth - 1);
+        positionUndo(pos, col);
+    }
+    return nodes;
+}
+
+long long perftBoard(char board[][MAX_COLS], int rows, int cols, int connectN, int player, int depth){
+    //perftPosition on the char board functions, the reference the bitboards must match
+    if (depth == 0)
+        return 1;
+
+    char token = player == 0 ? TOKEN_P1 : TOKEN_P2;
+    long long nodes = 0;
+    for (int col = 0; col < cols; col++){
+        if (!insertToken(board, rows, cols, token, col))
+            continue;
+        int row = rows - getColumnHeight(board, rows, col);
+        if (depth == 1)
+            nodes++;
+        else if (!checkIfNumSequenceForPlayerBecauseOfLastMove(token, board, rows, cols, connectN, row, col)
+                 && !isBoardFull(board, rows, cols))
+            nodes += perftBoard(board, rows, cols, connectN, 1 - player, depth - 1);
+        uninsertToken(board, rows, cols, col);
+    }
+    return nodes;
+}
+
+long long expectedPerft(const BoardOptions *board, const char *moves, int depth){
+    //known counts from the empty 6 x 7 connect 4 board, -1 where none is known
+    static const long long standard[] = {1, 7, 49, 343, 2401, 16807, 117649, 823536, 5673234, 39394572};
+    if (board->rows != 6 || board->cols != 7 || board->connectN != 4 || moves[0] != '\0')
+        return -1;
+    if (depth >= (int)(sizeof(standard) / sizeof(standard[0])))
+        return -1;
+    return standard[depth];
+}
+
+int runPerft(const BoardOptions *board, const char *moves, int maxDepth){
+    //perft of the position after moves on both board representations.
+    //returns 0 if they disagree with each other or with a known count.
+    Position pos;
+    int player = positionFromMoves(&pos, board, moves);
+    if (player < 0)
+        return 1;  //this position does not exist on this board
+
+    char grid[MAX_ROWS][MAX_COLS];
+    initBoard(grid, board->rows, board->cols);
+    for (const char *c = moves; *c; c++)
+        insertToken(grid, board->rows, board->cols, (c - moves) % 2 == 0 ? TOKEN_P1 : TOKEN_P2, moveFromChar(*c));
+
+    int ok = 1;
+    for (int depth = 1; depth <= maxDepth; depth++){
+        long long start = monotonicNanos();
+        long long nodes = perftPosition(&pos, player, depth);
+        long long middle = monotonicNanos();
+        long long reference = perftBoard(grid, board->rows, board->cols, board->connectN, player, depth);
+        long long end = monotonicNanos();
+        long long expected = expectedPerft(board, moves, depth);
+
+        int match = nodes == reference && (expected < 0 || nodes == expected);
+        ok = ok && match;
+        printf("perft %-8s depth %2d: %12lld  bitboard %7.1f Mnodes/s  board %7.1f Mnodes/s  %s\n",
+               moves[0] ? moves : "start", depth, nodes,
+               middle > start ? nodes * 1e3 / (middle - start) : 0.0,
+               end > middle ? reference * 1e3 / (end - middle) : 0.0,
+               match ? "ok" : "MISMATCH");
+    }
+    return ok;
+}
+
+void fillBenchSet(BenchSet *set, const BoardOptions *board, uint64_t seed){
+    //random games stopped between a quarter and three quarters of the board,
+    //always before a move that would win
+    uint64_t rng = seed;
+    int cells = board->rows * board->cols;
+    setIndexMap(set->indexMap, board->cols);
+    set->count = BENCH_POSITIONS;
+    for (int i = 0; i < set->count; i++){
+        Position *pos = &set->positions[i];
+        positionInit(pos, board->rows, board->cols, board->connectN);
+        initBoard(set->boards[i], board->rows, board->cols);
+        int length = cells / 4 + (int)(nextRandom(&rng) % (uint64_t)(cells / 2 + 1));
+        int player = 0;
+        set->lastPlayer[i] = -1;
+        while (pos->moveCount < length && pos->moveCount < cells - 1){
+            int col = (int)(nextRandom(&rng) % (uint64_t)board->cols);
+            if (!positionCanPlay(pos, col))
+                continue;
+            if (isWinningMove(pos, player, col, board->connectN))
+                break;
+            positionPlay(pos, player, col);
+            insertToken(set->boards[i], board->rows, board->cols, player == 0 ? TOKEN_P1 : TOKEN_P2, col);
+            set->lastPlayer[i] = player;
+            set->lastRow[i] = board->rows - pos->heights[col];
+            set->lastCol[i] = col;
+            player = 1 - player;
+        }
+        if (set->lastPlayer[i] == -1){
+            //no move could be made safely, fall back to a single token
+            positionPlay(pos, 0, 0);
+            insertToken(set->boards[i], board->rows, board->cols, TOKEN_P1, 0);
+            set->lastPlayer[i] = 0;
+            set->lastRow[i] = board->rows - 1;
+            set->lastCol[i] = 0;
+        }
+    }
+}
+
+long long benchInsertToken(BenchSet *set, long long *sink){
+    long long ops = 0;
+    const Position *first = &set->positions[0];
+    for (int i = 0; i < set->count; i++){
+        for (int col = 0; col < first->cols; col++){
+            if (insertToken(set->boards[i], first->rows, first->cols, TOKEN_P1, col)){
+                *sink += uninsertToken(set->boards[i], first->rows, first->cols, col);
+                ops++;
+            }
+        }
+    }
+    return ops;
+}
+
+long long benchPositionPlay(BenchSet *set, long long *sink){
+    long long ops = 0;
+    for (int i = 0; i < set->count; i++){
+        Position *pos = &set->positions[i];
+        for (int col = 0; col < pos->cols; col++){
+            if (positionCanPlay(pos, col)){
+                positionPlay(pos, 0, col);
+                *sink += positionUndo(pos, col);
+                ops++;
+            }
+        }
+    }
+    return ops;
+}
+
+long long benchSequenceScan(BenchSet *set, long long *sink){
+    const Position *first = &set->positions[0];
+    for (int i = 0; i < set->count; i++)
+        *sink += checkIfNumSequenceForPlayer(TOKEN_P1, set->boards[i], first->rows, first->cols, first->connectN);
+    return set->count;
+}
+
+long long benchLastMoveCheck(BenchSet *set, long long *sink){
+    const Position *first = &set->positions[0];
+    for (int i = 0; i < set->count; i++){
+        char token = set->lastPlayer[i] == 0 ? TOKEN_P1 : TOKEN_P2;
+        *sink += checkIfNumSequenceForPlayerBecauseOfLastMove(token, set->boards[i], first->rows, first->cols,
+                                                              first->connectN, set->lastRow[i], set->lastCol[i]);
+    }
+    return set->count;
+}
+
+long long benchPositionLastMove(BenchSet *set, long long *sink){
+    for (int i = 0; i < set->count; i++){
+        const Position *pos = &set->positions[i];
+        *sink += positionMoveMakesSequence(pos, set->lastPlayer[i], set->lastCol[i], pos->connectN);
+    }
+    return set->count;
+}
+
+long long benchPossibleSequence(BenchSet *set, long long *sink){
+    const Position *first = &set->positions[0];
+    for (int i = 0; i < set->count; i++)
+        *sink += checkPlayerForPossibleSequence(set->boards[i], first->rows, first->cols, TOKEN_P1, first->connectN, set->indexMap);
+    return set->count;
+}
+
+long long benchPositionSequenceMove(BenchSet *set, long long *sink){
+    for (int i = 0; i < set->count; i++){
+        const Position *pos = &set->positions[i];
+        *sink += findPositionSequenceMove(pos, 0, pos->connectN, set->indexMap);
+    }
+    return set->count;
+}
+
+long long benchComputerMove(BenchSet *set, long long *sink){
+    const Position *first = &set->positions[0];
+    for (int i = 0; i < set->count; i++)
+        *sink += generateComputerPlayerMove(set->boards[i], first->rows, first->cols, TOKEN_P1, TOKEN_P2, set->indexMap);
+    return set->count;
+}
+
+long long benchPositionMove(BenchSet *set, long long *sink){
+    for (int i = 0; i < set->count; i++){
+        const Position *pos = &set->positions[i];
+        *sink += generatePositionMove(pos, 0, pos->connectN, set->indexMap);
+    }
+    return set->count;
+}
+
+long long benchBatchRuleMoves(BenchSet *set, long long *sink){
+    //the same positions as benchPositionMove, gathered into a structure of arrays on
+    //every pass like a caller would
+    uint64_t tokens[2][BENCH_POSITIONS];
+    uint8_t players[BENCH_POSITIONS];
+    int8_t moves[BENCH_POSITIONS];
+    for (int i = 0; i < BENCH_POSITIONS; i++){
+        tokens[0][i] = (uint64_t)set->positions[i].tokens[0];
+        tokens[1][i] = (uint64_t)set->positions[i].tokens[1];
+        players[i] = 0;
+    }
+    const Position *first = &set->positions[0];
+    batchRuleMoves(tokens[0], tokens[1], players, set->count, first->rows, first->cols, first->connectN, set->indexMap, moves);
+    for (int i = 0; i < set->count; i++)
+        *sink += moves[i];
+    return set->count;
+}
+
+void runMicroBenchmark(const char *name, BenchFunction function, BenchSet *set){
+    //repeats whole passes over the set until BENCH_MIN_NANOS have gone by
+    long long sink = 0;
+    long long ops = 0;
+    long long start = monotonicNanos();
+    long long elapsed;
+    do {
+        ops += function(set, &sink);
+        elapsed = monotonicNanos() - start;
+    } while (elapsed < BENCH_MIN_NANOS);
+    //the sink is printed so that the compiler cannot drop the calls
+    printf("%-50s %9.1f ns/op  (%lld ops, sink %lld)\n", name, ops ? (double)elapsed / ops : 0.0, ops, sink);
+}
+
+int compareLongLong(const void *a, const void *b){
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+void runLatencyBenchmark(const EngineOptions *engine, const BoardOptions *board, int games){
+    //times every computer move of games self-play games and prints a histogram
+    //with one bucket per power of two nanoseconds
+    int cells = board->rows * board->cols;
+    long long *latencies = malloc((size_t)games * (size_t)cells * sizeof(long long) + 1);
+    if (latencies == NULL){
+        fprintf(stderr, "Out of memory for the latency benchmark.\n");
+        return;
+    }
+
+    SearchContext contexts[2];
+    searchContextInit(&contexts[0], engine, board->cols, board->connectN);
+    searchContextInit(&contexts[1], engine, board->cols, board->connectN);
+    long long count = 0;
+    for (int game = 0; game < games; game++){
+        uint64_t rng = mix64((uint64_t)game + 1);
+        Position pos;
+        positionInit(&pos, board->rows, board->cols, board->connectN);
+        int player = 0;
+        while (!positionIsFull(&pos)){
+            int col;
+            if (pos.moveCount < DEFAULT_RANDOM_PLIES){
+                int choices[MAX_COLS];
+                int choiceCount = orderMoves(&pos, &contexts[player], -1, choices);
+                col = choices[nextRandom(&rng) % (uint64_t)choiceCount];
+            }
+            else{
+                long long start = monotonicNanos();
+                col = computerPlayerMove(&pos, player, &contexts[player]);
+                latencies[count++] = monotonicNanos() - start;
+            }
+            positionPlay(&pos, player, col);
+            if (positionMoveMakesSequence(&pos, player, col, pos.connectN))
+                break;
+            player = 1 - player;
+        }
+    }
+    searchContextFree(&contexts[0]);
+    searchContextFree(&contexts[1]);
+
+    if (count == 0){
+        free(latencies);
+        return;
+    }
+    long long buckets[LATENCY_BUCKETS] = {0};
+    long long largest = 0;
+    for (long long i = 0; i < count; i++){
+        int bucket = 0;
+        while (bucket < LATENCY_BUCKETS - 1 && (latencies[i] >> (bucket + 1)) != 0)
+            bucket++;
+        buckets[bucket]++;
+        if (buckets[bucket] > largest)
+            largest = buckets[bucket];
+    }
+    qsort(latencies, (size_t)count, sizeof(long long), compareLongLong);
+    printf("move latency over %lld moves (%s player): p50 %.3f us, p90 %.3f us, p99 %.3f us, max %.3f us\n",
+           count, (const char *[]){"", "rule", "search", "max", "mcts"}[engine->aiMode],
+           latencies[count / 2] / 1e3, latencies[count * 9 / 10] / 1e3,
+           latencies[count * 99 / 100] / 1e3, latencies[count - 1] / 1e3);
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++){
+        if (buckets[bucket] == 0)
+            continue;
+        char bar[41];
+        int width = (int)(buckets[bucket] * 40 / largest);
+        memset(bar, '#', (size_t)width);
+        bar[width] = '\0';
+        printf("  %12.3f - %12.3f us %8lld %s\n", (double)(1LL << bucket) / 1e3,
+               (double)(1LL << bucket) * 2 / 1e3, buckets[bucket], bar);
+    }
+    free(latencies);
+}
+
+int runBenchmarks(const EngineOptions *engine, const BenchOptions *bench, const BoardOptions *board){
+    //perft counts on both board representations double as a correctness check:
+    //returns 0 if any of them disagree
+    static const char *const perftPositions[] = {"", "4444", "3455432", "1234567"};
+    int ok = 1;
+    for (size_t i = 0; i < sizeof(perftPositions) / sizeof(perftPositions[0]); i++)
+        ok = runPerft(board, perftPositions[i], i == 0 ? bench->perftDepth : bench->perftDepth - 1) && ok;
 
-    //1. if it is possible to win on the next move - choose the column that produces the win.
-    int winningMove = checkPlayerForPossibleSequence(board, rows, cols, playerToken, CONNECT_N, whatColsToCheckFirst);
-    if (winningMove != -1){
-        return winningMove;
+    BenchSet *set = malloc(sizeof(BenchSet));
+    if (set == NULL){
+        fprintf(stderr, "Out of memory for the benchmark positions.\n");
+        return 0;
     }
-    //2. if the opponent can win on their next move choose the column that prevents this.
-    int opponentWinningMove = checkPlayerForPossibleSequence(board, rows, cols, opposingPlayerToken, CONNECT_N, whatColsToCheckFirst);
-    if (opponentWinningMove != -1){
-        return opponentWinningMove;
+    fillBenchSet(set, board, 1);
+    printf("\n");
+    runMicroBenchmark("insertToken + uninsertToken", benchInsertToken, set);
+    runMicroBenchmark("positionPlay + positionUndo", benchPositionPlay, set);
+    runMicroBenchmark("checkIfNumSequenceForPlayer", benchSequenceScan, set);
+    runMicroBenchmark("checkIfNumSequenceForPlayerBecauseOfLastMove", benchLastMoveCheck, set);
+    runMicroBenchmark("positionMoveMakesSequence", benchPositionLastMove, set);
+    runMicroBenchmark("checkPlayerForPossibleSequence", benchPossibleSequence, set);
+    runMicroBenchmark("findPositionSequenceMove", benchPositionSequenceMove, set);
+    runMicroBenchmark("generateComputerPlayerMove", benchComputerMove, set);
+    runMicroBenchmark("generatePositionMove", benchPositionMove, set);
+    if (batchFitsLanes(board->rows, board->cols))
+        runMicroBenchmark("batchRuleMoves (per board)", benchBatchRuleMoves, set);
+    free(set);
+
+    printf("\n");
+    runLatencyBenchmark(engine, board, bench->games);
+    return ok;
+}
+
+void fuzzBoardSize(uint64_t *rngState, BoardOptions *board){
+    //a quarter of the games on the sizes with specialized code, the rest on any valid size
+    static const int special[3][3] = {{6, 7, 4}, {7, 8, 4}, {9, 10, 5}};
+    uint64_t r = nextRandom(rngState);
+    if (r % 4 == 0){
+        int k = (int)(r / 4 % 3);
+        board->rows = special[k][0];
+        board->cols = special[k][1];
+        board->connectN = special[k][2];
+        if (isValidBoardSize(board->rows, board->cols, board->connectN))
+            return;
     }
+    do {
+        board->rows = 1 + (int)(nextRandom(rngState) % MAX_ROWS);
+        board->cols = 1 + (int)(nextRandom(rngState) % MAX_COLS);
+        int longest = board->rows > board->cols ? board->rows : board->cols;
+        //up to one more than fits, so that some boards have no sequence at all
+        board->connectN = 2 + (int)(nextRandom(rngState) % (uint64_t)longest);
+    } while (!isValidBoardSize(board->rows, board->cols, board->connectN));
+}
 
-    //3. if it is possible to create a sequence of three tokens do so.
-    int moveForASequenceOf3 = checkPlayerForPossibleSequence(board, rows, cols, playerToken, 3, whatColsToCheckFirst);
-    if (moveForASequenceOf3 != -1){
-        return moveForASequenceOf3;
+int referenceSequenceMove(char board[][MAX_COLS], int rows, int cols, char playerToken, int sequenceNum, const int indexMap[MAX_COLS]){
+    //the original checkPlayerForPossibleSequence: insert a token into every column in turn
+    //and look for a sequence through it on the char board
+    for (int i = 0; i < cols; i++){
+        int col = indexMap[i];
+        if (!insertToken(board, rows, cols, playerToken, col))
+            continue;
+        int row = rows - getColumnHeight(board, rows, col);
+        int isSequence = checkIfNumSequenceForPlayerBecauseOfLastMove(playerToken, board, rows, cols, sequenceNum, row, col);
+        uninsertToken(board, rows, cols, col);
+        if (isSequence)
+            return col;
     }
+    return -1;
+}
 
-    //4. Blocking the opponent’s sequence of three
-    int OpponentmoveForASequenceOf3 = checkPlayerForPossibleSequence(board, rows, cols, opposingPlayerToken, 3, whatColsToCheckFirst);
-    if (OpponentmoveForASequenceOf3 != -1){
-        return OpponentmoveForASequenceOf3;
+int referenceRuleMove(char board[][MAX_COLS], int rows, int cols, int connectN, int player, const int indexMap[MAX_COLS]){
+    //the original generateComputerPlayerMove on the char board, with the sequence of three
+    //generalized to connectN - 1 like generatePositionMove
+    char own = player == 0 ? TOKEN_P1 : TOKEN_P2;
+    char other = player == 0 ? TOKEN_P2 : TOKEN_P1;
+    const char tokens[4] = {own, other, own, other};
+    const int lengths[4] = {connectN, connectN, connectN - 1, connectN - 1};
+    for (int priority = 0; priority < 4; priority++){
+        int move = referenceSequenceMove(board, rows, cols, tokens[priority], lengths[priority], indexMap);
+        if (move != -1)
+            return move;
+    }
+    for (int i = 0; i < cols; i++){
+        if (checkIfPossibleToPutInAColumn(board, rows, cols, indexMap[i]))
+            return indexMap[i];
     }
+    return -1;
+}
 
-    // Ordering rule for columns
-    // When several options have the same priority level, choose a column according to the following rules:
-    // 1. Prefer the column whose distance from the center column is minimal.
-    // 2. If the distance is equal, choose the left column among the two.
+int fuzzMismatch(char *what, size_t size, const char *check, int arg, long long reference, long long optimized){
+    snprintf(what, size, "%s(%d): reference %lld, optimized %lld", check, arg, reference, optimized);
+    return -1;
+}
 
-    for (int i = 0; i < cols; i++){
-        int column = whatColsToCheckFirst[i];
-        if(checkIfPossibleToPutInAColumn(board, rows, cols, column)){
-            return column;
+int fuzzCheckPosition(const Position *pos, char board[][MAX_COLS], int player, int lastCol, const int order[MAX_COLS], char *what, size_t size){
+    //compares pos with the char board it mirrors; player is the side to move and lastCol the
+    //column just played, -1 on the empty board. returns the checks made, or -1 with the
+    //first disagreement in what.
+    const int rows = pos->rows;
+    const int cols = pos->cols;
+    const int connectN = pos->connectN;
+    int checks = 0;
+
+    Position loaded;
+    positionLoad(&loaded, board, rows, cols, connectN);
+    checks++;
+    if (loaded.tokens[0] != pos->tokens[0] || loaded.tokens[1] != pos->tokens[1] || loaded.moveCount != pos->moveCount)
+        return fuzzMismatch(what, size, "positionLoad tokens", loaded.moveCount, loaded.moveCount, pos->moveCount);
+    checks++;
+    if (loaded.hash != pos->hash || loaded.mirrorHash != pos->mirrorHash)
+        return fuzzMismatch(what, size, "incremental hash", 0, (long long)loaded.hash, (long long)pos->hash);
+
+    for (int col = 0; col < cols; col++){
+        checks += 2;
+        if (getColumnHeight(board, rows, col) != pos->heights[col])
+            return fuzzMismatch(what, size, "getColumnHeight", col, getColumnHeight(board, rows, col), pos->heights[col]);
+        if (checkIfPossibleToPutInAColumn(board, rows, cols, col) != positionCanPlay(pos, col))
+            return fuzzMismatch(what, size, "checkIfPossibleToPutInAColumn", col, !positionCanPlay(pos, col), positionCanPlay(pos, col));
+    }
+    checks++;
+    if (isBoardFull(board, rows, cols) != positionIsFull(pos))
+        return fuzzMismatch(what, size, "isBoardFull", 0, isBoardFull(board, rows, cols), positionIsFull(pos));
+
+    //sequences of connectN and of every shorter length down to 2, for both players
+    for (int p = 0; p < 2; p++){
+        char token = p == 0 ? TOKEN_P1 : TOKEN_P2;
+        for (int n = connectN; n >= 2; n--){
+            checks++;
+            int reference = checkIfNumSequenceForPlayer(token, board, rows, cols, n);
+            if (reference != positionHasSequence(pos, p, n))
+                return fuzzMismatch(what, size, "checkIfNumSequenceForPlayer", n, reference, !reference);
+        }
+    }
+    if (lastCol != -1){
+        int mover = 1 - player;
+        char token = mover == 0 ? TOKEN_P1 : TOKEN_P2;
+        int row = rows - getColumnHeight(board, rows, lastCol);
+        for (int n = connectN; n >= 2; n--){
+            checks++;
+            int reference = checkIfNumSequenceForPlayerBecauseOfLastMove(token, board, rows, cols, n, row, lastCol);
+            if (reference != positionMoveMakesSequence(pos, mover, lastCol, n))
+                return fuzzMismatch(what, size, "checkIfNumSequenceForPlayerBecauseOfLastMove", n, reference, !reference);
         }
     }
 
-    //never gets here but the compiler cries...
+    //the winning-cell maps against a probe token in every column, at connectN and one less
+    for (int n = connectN; n >= connectN - 1 && n >= 2; n--){
+        Bitboard cells[2];
+        positionWinningCells(pos, n, cells);
+        for (int p = 0; p < 2; p++){
+            char token = p == 0 ? TOKEN_P1 : TOKEN_P2;
+            for (int col = 0; col < cols; col++){
+                if (!positionCanPlay(pos, col))
+                    continue;
+                checks++;
+                insertToken(board, rows, cols, token, col);
+                int reference = checkIfNumSequenceForPlayerBecauseOfLastMove(token, board, rows, cols, n, rows - 1 - pos->heights[col], col);
+                uninsertToken(board, rows, cols, col);
+                int optimized = (cells[p] & positionCellBit(pos, pos->heights[col], col)) != 0;
+                if (reference != optimized)
+                    return fuzzMismatch(what, size, p == 0 ? "positionWinningCells player 1" : "positionWinningCells player 2", col, reference, optimized);
+            }
+        }
+    }
+
+    //the rule move, on a single board and through the batched lanes
+    if (!positionIsFull(pos)){
+        int reference = referenceRuleMove(board, rows, cols, connectN, player, order);
+        int optimized = generatePositionMove(pos, player, connectN, order);
+        checks++;
+        if (reference != optimized)
+            return fuzzMismatch(what, size, "generatePositionMove", player + 1, reference, optimized);
+        if (batchFitsLanes(rows, cols)){
+            uint64_t tokens0 = (uint64_t)pos->tokens[0];
+            uint64_t tokens1 = (uint64_t)pos->tokens[1];
+            uint8_t players = (uint8_t)player;
+            int8_t batched;
+            batchRuleMoves(&tokens0, &tokens1, &players, 1, rows, cols, connectN, order, &batched);
+            checks++;
+            if (reference != batched)
+                return fuzzMismatch(what, size, "batchRuleMoves", player + 1, reference, batched);
+        }
+    }
+    return checks;
+}
+
+int fuzzGame(FuzzJob *job, long long game){
+    //one random game on a random board: half the moves random and half the rule move, so that
+    //threats come up; half the games play on past the first sequence until the board is full.
+    //returns 0 after reporting a mismatch.
+    uint64_t rngState = mix64(job->batch->seed ^ mix64((uint64_t)game + 1));
+    BoardOptions board;
+    fuzzBoardSize(&rngState, &board);
+    int playToFull = nextRandom(&rngState) & 1;
+    int order[MAX_COLS];
+    setIndexMap(order, board.cols);
+
+    char grid[MAX_ROWS][MAX_COLS];
+    Position pos;
+    initBoard(grid, board.rows, board.cols);
+    positionInit(&pos, board.rows, board.cols, board.connectN);
+
+    char what[256];
+    char moves[MAX_CELLS + 1];
+    int player = 0;
+    int lastCol = -1;
+    long long checks = 0;
+    long long positions = 0;
+    int done;
+    while (1){
+        done = fuzzCheckPosition(&pos, grid, player, lastCol, order, what, sizeof(what));
+        positions++;
+        if (done < 0)
+            break;
+        checks += done;
+        if (positionIsFull(&pos) || (!playToFull && lastCol != -1 && positionMoveMakesSequence(&pos, 1 - player, lastCol, board.connectN)))
+            break;
+
+        int col;
+        if (nextRandom(&rngState) & 1){
+            col = generatePositionMove(&pos, player, board.connectN, order);
+        }
+        else{
+            do {
+                col = (int)(nextRandom(&rngState) % (uint64_t)board.cols);
+            } while (!positionCanPlay(&pos, col));
+        }
+        moves[pos.moveCount] = moveChar(col);
+        insertToken(grid, board.rows, board.cols, player == 0 ? TOKEN_P1 : TOKEN_P2, col);
+        positionPlay(&pos, player, col);
+        lastCol = col;
+        player = 1 - player;
+    }
+    moves[pos.moveCount] = '\0';
+
+    //taking every move back must lead to the empty board on both sides
+    const char *when = "after";
+    if (done >= 0){
+        for (int i = pos.moveCount - 1; i >= 0; i--){
+            int col = moveFromChar(moves[i]);
+            positionUndo(&pos, col);
+            uninsertToken(grid, board.rows, board.cols, col);
+        }
+        done = fuzzCheckPosition(&pos, grid, 0, -1, order, what, sizeof(what));
+        positions++;
+        checks += done;
+        when = "after taking back";
+    }
+    atomic_fetch_add(&job->positions, positions);
+    atomic_fetch_add(&job->checks, checks);
+    if (done >= 0)
+        return 1;
+
+    pthread_mutex_lock(&job->lock);
+    if (!atomic_load(&job->failed))
+        snprintf(job->report, sizeof(job->report), "game %lld on %d x %d, connect %d, %s moves %s: %s",
+                 game, board.rows, board.cols, board.connectN, when, moves, what);
+    atomic_store(&job->failed, 1);
+    pthread_mutex_unlock(&job->lock);
+    return 0;
+}
+
+void *fuzzWorker(void *arg){
+    FuzzJob *job = arg;
+    while (!atomic_load(&job->failed)){
+        long long first = atomic_fetch_add(&job->nextGame, FUZZ_CHUNK);
+        if (first >= job->games)
+            break;
+        long long last = first + FUZZ_CHUNK < job->games ? first + FUZZ_CHUNK : job->games;
+        for (long long game = first; game < last && fuzzGame(job, game); game++)
+            ;
+    }
+    countersFlush();
+    return NULL;
+}
+
+int runFuzz(const BatchOptions *batch, long long games){
+    //games are seeded by their number, so a reported game replays the same with any thread count
+    FuzzJob job;
+    job.batch = batch;
+    job.games = games;
+    atomic_init(&job.nextGame, 0);
+    atomic_init(&job.positions, 0);
+    atomic_init(&job.checks, 0);
+    atomic_init(&job.failed, 0);
+    pthread_mutex_init(&job.lock, NULL);
+    job.report[0] = '\0';
+
+    long long start = monotonicNanos();
+    int threads = workerThreadCount(batch->threads);
+    pthread_t *workers = malloc((size_t)threads * sizeof(pthread_t));
+    int started = 0;
+    for (; workers != NULL && started < threads; started++){
+        if (pthread_create(&workers[started], NULL, fuzzWorker, &job) != 0)
+            break;
+    }
+    if (started == 0)
+        fuzzWorker(&job);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+    pthread_mutex_destroy(&job.lock);
+
+    double seconds = (monotonicNanos() - start) / 1e9;
+    long long positions = atomic_load(&job.positions);
+    printf("%lld positions, %lld checks on %d threads in %.3f s (%.0f positions/s)\n",
+           positions, (long long)atomic_load(&job.checks), started ? started : 1, seconds,
+           seconds > 0 ? positions / seconds : 0.0);
+    if (atomic_load(&job.failed)){
+        printf("Mismatch in %s\n", job.report);
+        return 0;
+    }
+    printf("%lld games, no mismatches\n", games);
+    return 1;
+}
+
+void defaultTournamentOptions(TournamentOptions *tournament){
+    tournament->games = 0;
+    tournament->openingsPath = NULL;
+    tournament->playerCount = 0;
+}
+
+int parseTournamentOption(TournamentOptions *tournament, const char *arg){
+    if (strncmp(arg, "--tournament=", 13) == 0){
+        tournament->games = atoll(arg + 13);
+        return tournament->games > 0;
+    }
+    if (strncmp(arg, "--player=", 9) == 0){
+        if (tournament->playerCount == MAX_PLAYERS)
+            return 0;
+        tournament->players[tournament->playerCount++] = arg + 9;
+        return 1;
+    }
+    if (strncmp(arg, "--openings=", 11) == 0){
+        tournament->openingsPath = arg + 11;
+        return arg[11] != '\0';
+    }
+    return 0;
+}
+
+int parsePlayerSpec(EngineOptions *player, const char *spec){
+    //applies the comma separated engine options of a --player spec, written without their
+    //leading dashes, on top of player. returns 0 for an unknown or invalid option.
+    char option[256];
+    while (*spec){
+        size_t length = strcspn(spec, ",");
+        if (length == 0 || length + 3 > sizeof(option))
+            return 0;
+        option[0] = '-';
+        option[1] = '-';
+        memcpy(option + 2, spec, length);
+        option[length + 2] = '\0';
+        if (!parseEngineOption(player, option))
+            return 0;
+        spec += length;
+        if (*spec == ',')
+            spec++;
+    }
+    return 1;
+}
+
+long long loadOpenings(const char *path, const BoardOptions *board, GameRecord **openings){
+    //reads the openings of a game file: every game that is legal and not over yet.
+    //returns how many there are, -1 if the file cannot be read.
+    GameReader reader;
+    if (!gameReaderOpen(&reader, path, board))
+        return -1;
+    if (reader.board.rows != board->rows || reader.board.cols != board->cols || reader.board.connectN != board->connectN){
+        fclose(reader.file);
+        return -1;
+    }
+    long long count = 0, capacity = 0, skipped = 0;
+    *openings = NULL;
+    GameRecord record;
+    int status;
+    while ((status = gameReaderNext(&reader, &record)) > 0){
+        Position pos;
+        char moves[MAX_CELLS + 1];
+        recordMoveString(&record, moves);
+        if (positionFromMoves(&pos, board, moves) == -1){
+            skipped++;
+            continue;
+        }
+        if (count == capacity){
+            capacity = capacity ? capacity * 2 : 64;
+            GameRecord *grown = realloc(*openings, (size_t)capacity * sizeof(GameRecord));
+            if (grown == NULL)
+                break;
+            *openings = grown;
+        }
+        (*openings)[count++] = record;
+    }
+    fclose(reader.file);
+    if (status < 0 || skipped > 0)
+        fprintf(stderr, "%lld openings of %s skipped: illegal, finished or unreadable.\n", skipped + (status < 0), path);
+    return count;
+}
+
+void tournamentPairing(int playerCount, long long pairing, int *first, int *second){
+    //the pairing-th pair of a round robin: 0-1, 0-2, ..., 1-2, ...
+    *first = 0;
+    *second = 1;
+    for (int a = 0; a < playerCount; a++){
+        if (pairing < playerCount - 1 - a){
+            *first = a;
+            *second = a + 1 + (int)pairing;
+            return;
+        }
+        pairing -= playerCount - 1 - a;
+    }
+}
+
+void playTournamentGame(const TournamentJob *job, long long index, TournamentGame *game){
+    //the games of a pairing come in twos with the same opening, the second with the
+    //colors swapped. every player gets fresh tables, so a game only depends on its number.
+    long long round = index % job->gamesPerPairing;
+    int first, second;
+    tournamentPairing(job->playerCount, index / job->gamesPerPairing, &first, &second);
+    game->players[0] = round % 2 ? second : first;
+    game->players[1] = round % 2 ? first : second;
+
+    SearchContext contexts[2];
+    for (int i = 0; i < 2; i++){
+        searchContextInit(&contexts[i], &job->players[game->players[i]], job->board->cols, job->board->connectN);
+        game->moves[i] = 0;
+        game->nanos[i] = 0;
+        game->nodes[i] = 0;
+    }
+
+    Position pos;
+    GameRecord *record = &game->record;
+    positionInit(&pos, job->board->rows, job->board->cols, job->board->connectN);
+    record->length = 0;
+    record->winner = 0;
+    int playing = 1;
+    int player = 0;
+    if (job->openings != NULL){
+        const GameRecord *opening = &job->openings[(round / 2) % job->openingCount];
+        for (int i = 0; playing && i < opening->length; i++){
+            playing = selfPlayMove(&pos, player, opening->moves[i], record);
+            player = 1 - player;
+        }
+    }
+    else{
+        //seeded like the batch games, so every pairing sees the same openings
+        uint64_t rngState = mix64(job->batch->seed ^ mix64((uint64_t)(round / 2) + 1));
+        for (int i = 0; playing && i < job->batch->randomPlies; i++){
+            int choices[MAX_COLS];
+            int count = orderMoves(&pos, &contexts[player], -1, choices);
+            playing = selfPlayMove(&pos, player, choices[nextRandom(&rngState) % count], record);
+            player = 1 - player;
+        }
+    }
+    while (playing){
+        contexts[player].nodes = 0;
+        long long start = monotonicNanos();
+        int col = computerPlayerMove(&pos, player, &contexts[player]);
+        game->nanos[player] += monotonicNanos() - start;
+        game->nodes[player] += contexts[player].nodes;
+        game->moves[player]++;
+        playing = selfPlayMove(&pos, player, col, record);
+        player = 1 - player;
+    }
+    searchContextFree(&contexts[0]);
+    searchContextFree(&contexts[1]);
+}
+
+void *tournamentWorker(void *arg){
+    //games are taken one at a time, a single game can take long enough to keep a thread busy
+    TournamentJob *job = arg;
+    TournamentGame game;
+    while (1){
+        long long index = atomic_fetch_add(&job->nextGame, 1);
+        if (index >= job->totalGames)
+            break;
+        playTournamentGame(job, index, &game);
+        tournamentEmit(job, index, &game);
+    }
+    countersFlush();
+    return NULL;
+}
+
+void tournamentEmit(TournamentJob *job, long long index, const TournamentGame *game){
+    //the ordered sink of batchEmit with one game per slot: a game is counted and recorded
+    //once every earlier game is, otherwise it waits in the window for them
+    pthread_mutex_lock(&job->lock);
+    while (index - job->nextIndex >= job->windowGames)
+        pthread_cond_wait(&job->slotFree, &job->lock);
+    long long slot = index % job->windowGames;
+    job->window[slot] = *game;
+    job->windowReady[slot] = 1;
+
+    int taken = 0;
+    while (job->windowReady[slot = job->nextIndex % job->windowGames]){
+        const TournamentGame *next = &job->window[slot];
+        for (int side = 0; side < 2; side++){
+            int player = next->players[side], opponent = next->players[1 - side];
+            int result = next->record.winner == 0 ? 1 : next->record.winner == side + 1 ? 0 : 2;
+            job->results[player][opponent][result]++;
+            job->moves[player] += next->moves[side];
+            job->nanos[player] += next->nanos[side];
+            job->nodes[player] += next->nodes[side];
+        }
+        if (job->recordFile != NULL && job->recorded && !gameWriterWrite(job->recordFile, &next->record)){
+            //said once, when it happens; the tournament itself goes on
+            fprintf(stderr, "Cannot write games to %s.\n", job->batch->recordPath);
+            job->recorded = 0;
+        }
+        job->windowReady[slot] = 0;
+        job->nextIndex++;
+        taken = 1;
+    }
+    if (taken)
+        pthread_cond_broadcast(&job->slotFree);
+    pthread_mutex_unlock(&job->lock);
+}
+
+double naturalLog(double x){
+    //ln(x) for x > 0 without libm: x = m * 2^e with m in [1, 2), then the atanh series of m
+    int exponent = 0;
+    while (x >= 2.0){
+        x /= 2.0;
+        exponent++;
+    }
+    while (x < 1.0){
+        x *= 2.0;
+        exponent--;
+    }
+    double z = (x - 1.0) / (x + 1.0);
+    double power = z, sum = 0.0;
+    for (int k = 1; k < 40; k += 2){
+        sum += power / k;
+        power *= z * z;
+    }
+    return 2.0 * sum + exponent * 0.69314718055994530942;
+}
+
+double squareRoot(double x){
+    //Newton's method without libm
+    if (x <= 0.0)
+        return 0.0;
+    double root = x > 1.0 ? x : 1.0;
+    for (int i = 0; i < 64; i++){
+        double next = (root + x / root) / 2.0;
+        if (next >= root)
+            break;
+        root = next;
+    }
+    return root;
+}
+
+double eloFromScore(double score){
+    //the rating difference that makes score the expected result: 400 log10(s / (1 - s))
+    return 400.0 / 2.30258509299404568402 * naturalLog(score / (1.0 - score));
+}
+
+void formatElo(char *text, size_t size, long long wins, long long draws, long long losses){
+    //the Elo difference the result implies with its 95% interval, from the variance of
+    //the per game results
+    long long games = wins + draws + losses;
+    if (games == 0){
+        snprintf(text, size, "%s", "-");
+        return;
+    }
+    double score = (wins + draws / 2.0) / games;
+    if (wins == games || losses == games){
+        snprintf(text, size, "%s", wins ? "+inf" : "-inf");
+        return;
+    }
+    double variance = (wins * (1.0 - score) * (1.0 - score) + draws * (0.5 - score) * (0.5 - score)
+                       + losses * score * score) / games;
+    double margin = 1.96 * squareRoot(variance / games);
+    double elo = eloFromScore(score);
+    if (score - margin <= 0.0 || score + margin >= 1.0)
+        snprintf(text, size, "%+.1f +- inf", elo);
+    else
+        snprintf(text, size, "%+.1f +- %.1f", elo, (eloFromScore(score + margin) - eloFromScore(score - margin)) / 2.0);
+}
+
+int runTournament(const EngineOptions *engine, const TournamentOptions *tournament, const BatchOptions *batch, const BoardOptions *board){
+    //a round robin of the --player engines on --threads workers: tournament->games games
+    //per pairing, rounded up to an even number for the color swap. prints the result of
+    //every pairing and every player's result against the field with its cost per move.
+    if (tournament->playerCount < 2){
+        fprintf(stderr, "A tournament needs at least two --player options.\n");
+        return 0;
+    }
+    EngineOptions players[MAX_PLAYERS];
+    for (int i = 0; i < tournament->playerCount; i++){
+        players[i] = *engine;
+        if (!parsePlayerSpec(&players[i], tournament->players[i])){
+            fprintf(stderr, "Bad player \"%s\".\n", tournament->players[i]);
+            return 0;
+        }
+    }
+
+    TournamentJob job;
+    job.players = players;
+    job.playerCount = tournament->playerCount;
+    job.batch = batch;
+    job.board = board;
+    job.openings = NULL;
+    job.openingCount = 0;
+    if (tournament->openingsPath != NULL){
+        GameRecord *openings;
+        job.openingCount = loadOpenings(tournament->openingsPath, board, &openings);
+        if (job.openingCount < 0){
+            fprintf(stderr, "Cannot read openings for %d rows x %d cols, connect %d from %s.\n",
+                    board->rows, board->cols, board->connectN, tournament->openingsPath);
+            return 0;
+        }
+        if (job.openingCount == 0){
+            fprintf(stderr, "No usable openings in %s.\n", tournament->openingsPath);
+            free(openings);
+            return 0;
+        }
+        job.openings = openings;
+    }
+    long long pairings = (long long)job.playerCount * (job.playerCount - 1) / 2;
+    job.gamesPerPairing = tournament->games + tournament->games % 2;
+    job.totalGames = pairings * job.gamesPerPairing;
+    atomic_init(&job.nextGame, 0);
+    int threads = workerThreadCount(batch->threads);
+    job.windowGames = 2 * (long long)threads * BATCH_CHUNK;
+    job.window = malloc((size_t)job.windowGames * sizeof(TournamentGame));
+    job.windowReady = calloc((size_t)job.windowGames, sizeof(int));
+    pthread_t *workers = malloc((size_t)threads * sizeof(pthread_t));
+    if (job.window == NULL || job.windowReady == NULL || workers == NULL){
+        fprintf(stderr, "Out of memory for %d threads.\n", threads);
+        free(job.window);
+        free(job.windowReady);
+        free(workers);
+        free((GameRecord *)job.openings);
+        return 0;
+    }
+    job.nextIndex = 0;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.slotFree, NULL);
+    job.recordFile = NULL;
+    job.recorded = 1;
+    memset(job.results, 0, sizeof(job.results));
+    memset(job.moves, 0, sizeof(job.moves));
+    memset(job.nanos, 0, sizeof(job.nanos));
+    memset(job.nodes, 0, sizeof(job.nodes));
+    if (batch->recordPath != NULL && !gameWriterOpen(&job.recordFile, batch->recordPath, board)){
+        //before any game is played, not after a long tournament
+        fprintf(stderr, "Cannot write games to %s.\n", batch->recordPath);
+        pthread_mutex_destroy(&job.lock);
+        pthread_cond_destroy(&job.slotFree);
+        free(job.window);
+        free(job.windowReady);
+        free(workers);
+        free((GameRecord *)job.openings);
+        return 0;
+    }
+
+    long long start = monotonicNanos();
+    int started = 0;
+    for (; started < threads; started++){
+        if (pthread_create(&workers[started], NULL, tournamentWorker, &job) != 0)
+            break;
+    }
+    if (started == 0)
+        tournamentWorker(&job);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    double seconds = (monotonicNanos() - start) / 1e9;
+
+    if (job.recordFile != NULL && fclose(job.recordFile) != 0 && job.recorded)
+        fprintf(stderr, "Cannot write games to %s.\n", batch->recordPath);
 
+    printf("%d players, %lld games on %d threads in %.3f s, %s openings\n", job.playerCount, job.totalGames,
+           started ? started : 1, seconds, job.openings != NULL ? tournament->openingsPath : "random");
+    for (int i = 0; i < job.playerCount; i++)
+        printf("  player %d: %s\n", i + 1, tournament->players[i]);
+    char elo[64];
+    for (long long pairing = 0; pairing < pairings; pairing++){
+        int a, b;
+        tournamentPairing(job.playerCount, pairing, &a, &b);
+        const long long *result = job.results[a][b];
+        formatElo(elo, sizeof(elo), result[0], result[1], result[2]);
+        printf("player %d vs player %d: +%lld =%lld -%lld, elo %s\n", a + 1, b + 1, result[0], result[1], result[2], elo);
+    }
+    printf("player     wins  draws losses  elo vs the field     ms/move    nodes/s\n");
+    for (int i = 0; i < job.playerCount; i++){
+        long long total[3] = {0, 0, 0};
+        for (int opponent = 0; opponent < job.playerCount; opponent++){
+            for (int r = 0; r < 3; r++)
+                total[r] += job.results[i][opponent][r];
+        }
+        formatElo(elo, sizeof(elo), total[0], total[1], total[2]);
+        printf("%6d %8lld %6lld %6lld  %-18s %10.3f %10.0f\n", i + 1, total[0], total[1], total[2], elo,
+               job.moves[i] ? job.nanos[i] / 1e6 / job.moves[i] : 0.0, job.nanos[i] ? job.nodes[i] / (job.nanos[i] / 1e9) : 0.0);
+    }
+    if (engine->showStats){
+        EngineCounters counters;
+        countersTotal(&counters);
+        dumpCounters(stderr, &counters);
+    }
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.slotFree);
+    free(job.window);
+    free(job.windowReady);
+    free(workers);
+    free((GameRecord *)job.openings);
+    return 1;
+}
+
+void countersFlush(void){
+    //adds the calling thread's counters to the process totals and clears them
+    pthread_mutex_lock(&countersLock);
+    mergedCounters.tokenInserts += threadCounters.tokenInserts;
+    mergedCounters.tokenUninserts += threadCounters.tokenUninserts;
+    mergedCounters.positionPlays += threadCounters.positionPlays;
+    mergedCounters.positionUndos += threadCounters.positionUndos;
+    mergedCounters.winChecks += threadCounters.winChecks;
+    mergedCounters.nodes += threadCounters.nodes;
+    mergedCounters.ttHits += threadCounters.ttHits;
+    mergedCounters.ttMisses += threadCounters.ttMisses;
+    mergedCounters.cutoffs += threadCounters.cutoffs;
+    mergedCounters.computerMoves += threadCounters.computerMoves;
+    mergedCounters.moveNanos += threadCounters.moveNanos;
+    if (threadCounters.maxMoveNanos > mergedCounters.maxMoveNanos)
+        mergedCounters.maxMoveNanos = threadCounters.maxMoveNanos;
+    mergedCounters.ponderHits += threadCounters.ponderHits;
+    mergedCounters.ponderMisses += threadCounters.ponderMisses;
+    pthread_mutex_unlock(&countersLock);
+    memset(&threadCounters, 0, sizeof(threadCounters));
+}
+
+void countersTotal(EngineCounters *total){
+    //the totals of every finished thread and the calling one
+    countersFlush();
+    pthread_mutex_lock(&countersLock);
+    *total = mergedCounters;
+    pthread_mutex_unlock(&countersLock);
+}
+
+void printCounters(const EngineCounters *counters, const long long moveNanos[], int moveCount){
+    //human readable summary of a game, moveNanos holds the time of each of its moves
+    //(-1 for a human move)
+    long long lookups = counters->ttHits + counters->ttMisses;
+    printf("Statistics:\n");
+    printf("  insertToken %lld, uninsertToken %lld, position plays %lld, undos %lld\n",
+           counters->tokenInserts, counters->tokenUninserts, counters->positionPlays, counters->positionUndos);
+    printf("  win checks %lld, nodes %lld, cutoffs %lld\n", counters->winChecks, counters->nodes, counters->cutoffs);
+    printf("  table hits %lld, misses %lld (%.1f%% hits)\n", counters->ttHits, counters->ttMisses,
+           lookups ? 100.0 * counters->ttHits / lookups : 0.0);
+    printf("  computer moves %lld, %.3f ms in total, %.3f ms on average, %.3f ms at most\n",
+           counters->computerMoves, counters->moveNanos / 1e6,
+           counters->computerMoves ? counters->moveNanos / 1e6 / counters->computerMoves : 0.0,
+           counters->maxMoveNanos / 1e6);
+    if (counters->ponderHits + counters->ponderMisses > 0)
+        printf("  ponder hits %lld, misses %lld\n", counters->ponderHits, counters->ponderMisses);
+    for (int i = 0; i < moveCount; i++){
+        if (moveNanos[i] >= 0)
+            printf("  move %d (player %d): %.3f ms\n", i + 1, i % 2 + 1, moveNanos[i] / 1e6);
+    }
+}
+
+void dumpCounters(FILE *file, const EngineCounters *counters){
+    //one line of key=value pairs for scripts
+    fprintf(file, "stats token_inserts=%lld token_uninserts=%lld position_plays=%lld position_undos=%lld "
+            "win_checks=%lld nodes=%lld tt_hits=%lld tt_misses=%lld cutoffs=%lld "
+            "computer_moves=%lld move_ns_total=%lld move_ns_max=%lld\n",
+            counters->tokenInserts, counters->tokenUninserts, counters->positionPlays, counters->positionUndos,
+            counters->winChecks, counters->nodes, counters->ttHits, counters->ttMisses, counters->cutoffs,
+            counters->computerMoves, counters->moveNanos, counters->maxMoveNanos);
+}
+
+int moveFromChar(char c){
+    //inverse of moveChar, -1 for a character that names no column
+    if (c >= '1' && c <= '9')
+        return c - '1';
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 9;
     return -1;
 }
 
-int getColumnHeight(char board[][COLS], int rows, int col) {
+int positionFromMoves(Position *pos, const BoardOptions *board, const char *moves){
+    //plays a move string from the start position and returns the player to move,
+    //or -1 if a move is illegal or the game is already over
+    positionInit(pos, board->rows, board->cols, board->connectN);
+    int player = 0;
+    for (const char *c = moves; *c; c++){
+        int col = moveFromChar(*c);
+        if (col < 0 || col >= pos->cols || !positionCanPlay(pos, col))
+            return -1;
+        positionPlay(pos, player, col);
+        if (positionMoveMakesSequence(pos, player, col, pos->connectN))
+            return -1;
+        player = 1 - player;
+    }
+    return positionIsFull(pos) ? -1 : player;
+}
+
+SearchResult analyzePosition(const Position *pos, int player, const EngineOptions *engine, int threads, double *seconds){
+    //one search with a fresh table, so that runs with different thread counts start equal
+    EngineOptions options = *engine;
+    options.aiMode = AI_SEARCH;
+    options.searchThreads = threads;
+
+    Position root = *pos;
+    SearchContext ctx;
+    searchContextInit(&ctx, &options, root.cols, root.connectN);
+    long long start = monotonicNanos();
+    SearchResult result = searchBestMove(&root, player, &ctx);
+    *seconds = (monotonicNanos() - start) / 1e9;
+    searchContextFree(&ctx);
+    return result;
+}
+
+int runAnalysis(const EngineOptions *engine, const BoardOptions *board, const char *moves){
+    //prints the search result for the position after moves. with more than one
+    //search thread it first searches alone, then reports the speedup to the same depth.
+    Position pos;
+    int player = positionFromMoves(&pos, board, moves);
+    if (player < 0){
+        fprintf(stderr, "Cannot analyze \"%s\": illegal move or finished game.\n", moves);
+        return 0;
+    }
+
+    double baseSeconds = 0;
+    int runs[2] = {1, engine->searchThreads};
+    for (int i = engine->searchThreads > 1 ? 0 : 1; i < 2; i++){
+        double seconds;
+        SearchResult result = analyzePosition(&pos, player, engine, runs[i], &seconds);
+        printf("threads %d: move %c score %d depth %d nodes %lld time %.3f s (%.0f nodes/s)\n",
+               runs[i], moveChar(result.move), result.score, result.depth, result.nodes,
+               seconds, seconds > 0 ? result.nodes / seconds : 0.0);
+        if (i == 0)
+            baseSeconds = seconds;
+        else if (engine->searchThreads > 1)
+            printf("speedup over 1 thread: %.2fx\n", seconds > 0 ? baseSeconds / seconds : 0.0);
+    }
+    return 1;
+}
+
+int runSolve(const EngineOptions *engine, const BoardOptions *board, const char *moves, int weak){
+    //solves the position after moves and prints the result, best move and node rate
+    Position pos;
+    int player = positionFromMoves(&pos, board, moves);
+    if (player < 0){
+        fprintf(stderr, "Cannot solve \"%s\": illegal move or finished game.\n", moves);
+        return 0;
+    }
+    EngineOptions options = *engine;
+    options.aiMode = AI_MAX;
+    SearchContext ctx;
+    searchContextInit(&ctx, &options, pos.cols, pos.connectN);
+    long long start = monotonicNanos();
+    SearchResult result = solveBestMove(&pos, player, weak, &ctx);
+    double seconds = (monotonicNanos() - start) / 1e9;
+    searchContextFree(&ctx);
+
+    if (result.depth == 0){
+        fprintf(stderr, "Not solved within the budget (%lld nodes, %.3f s).\n", result.nodes, seconds);
+        return 0;
+    }
+    const char *outcome = result.score > 0 ? "win" : (result.score < 0 ? "loss" : "draw");
+    if (weak || result.score == 0)
+        printf("%s", outcome);
+    else
+        printf("%s in %d plies", outcome, WIN_SCORE - (result.score > 0 ? result.score : -result.score));
+    printf(" for player %d, move %c nodes %lld time %.3f s (%.0f nodes/s)\n", player + 1,
+           moveChar(result.move), result.nodes, seconds, seconds > 0 ? result.nodes / seconds : 0.0);
+    return 1;
+}
+
+int getColumnHeight(char board[][MAX_COLS], int rows, int col) {
     if (board[0][col] != EMPTY)
         return rows;
 
@@ -448,7 +6471,7 @@ int getColumnHeight(char board[][COLS], int rows, int col) {
 
 }
 
-int isBoardFull(char board[][COLS], int rows, int cols){
+int isBoardFull(char board[][MAX_COLS], int rows, int cols){
     for (int col = 0; col < cols; col++)
         for (int row = 0; row < rows; row++)
             if (board[row][col] == EMPTY)
@@ -457,7 +6480,7 @@ int isBoardFull(char board[][COLS], int rows, int cols){
     return 1;
 }
 
-int checkIfPossibleToPutInAColumn(char board[][COLS], int rows, int cols, int col){
+int checkIfPossibleToPutInAColumn(char board[][MAX_COLS], int rows, int cols, int col){
     //we assume the column is valid
     const char dummyPlayerToken = TOKEN_P1;
     if (insertToken(board, rows, cols, dummyPlayerToken, col)){
@@ -468,7 +6491,7 @@ int checkIfPossibleToPutInAColumn(char board[][COLS], int rows, int cols, int co
 }
 
 
-int requestHumanInput(char board[][COLS], int rows, int cols) {
+int requestHumanInput(char board[][MAX_COLS], int rows, int cols) {
     int userInput;
     int validInput = 0;
     int isReadSuccessful;
@@ -476,7 +6499,7 @@ int requestHumanInput(char board[][COLS], int rows, int cols) {
 
     // Use a while loop that continues until valid input is received
     while (!validInput) {
-        printf("Enter column (1-%d): ", COLS);
+        printf("Enter column (1-%d): ", cols);
 
         isReadSuccessful = scanf(" %d", &userInput);
 
@@ -502,7 +6525,7 @@ int requestHumanInput(char board[][COLS], int rows, int cols) {
 }
 
 
-void setIndexMap(int array[COLS], int cols){
+void setIndexMap(int array[MAX_COLS], int cols){
     int indexCounter = 0;
 
     //if there is a only one column 
@@ -543,62 +6566,339 @@ void setIndexMap(int array[COLS], int cols){
     }
 }
 
-int playPlayerQueary(char board[][COLS], int rows, int cols, int IndexChoiseArray[COLS], int numPlayer, int playerType){
+int playPlayerQueary(char board[][MAX_COLS], int rows, int cols, int IndexChoiseArray[MAX_COLS], int numPlayer, int playerType){
+    Position pos;
+    SearchContext ctx;
+    EngineOptions options;
+    defaultEngineOptions(&options);
+    positionLoad(&pos, board, rows, cols, CONNECT_N);
+    searchContextInit(&ctx, &options, cols, CONNECT_N);
+    memcpy(ctx.order, IndexChoiseArray, sizeof(ctx.order));
+    GameOutput out;
+    outputInit(&out, RENDER_FULL, STDOUT_FILENO);
+    int playerMove = playPositionQueary(&pos, board, &ctx, numPlayer, playerType, &out);
+    outputFlush(&out);
+    searchContextFree(&ctx);
+    return playerMove;
+}
+
+int playPositionQueary(Position *pos, char board[][MAX_COLS], SearchContext *ctx, int numPlayer, int playerType, GameOutput *out){
     //player one, check human or computer
     int playerMove;
-    printf("Player %d (%c) turn. \n", numPlayer, numPlayer == 1 ? TOKEN_P1 : TOKEN_P2);
+    if (playerType == HUMAN || out->mode != RENDER_QUIET)
+        outputPrintf(out, "Player %d (%c) turn. \n", numPlayer, numPlayer == 1 ? TOKEN_P1 : TOKEN_P2);
     if (playerType == HUMAN){
-        playerMove = requestHumanInput(board, rows, cols);
+        outputFlush(out);
+        playerMove = requestHumanInput(board, pos->rows, pos->cols);
     }
     else{
-        playerMove = generateComputerPlayerMove(board, rows, cols, numPlayer == 1 ? TOKEN_P1 : TOKEN_P2, numPlayer != 1 ? TOKEN_P1 : TOKEN_P2, IndexChoiseArray);
-        printf("Computer chose column %d", playerMove + 1);
+        playerMove = computerPlayerMove(pos, numPlayer - 1, ctx);
+        if (out->mode != RENDER_QUIET)
+            outputPrintf(out, "Computer chose column %d", playerMove + 1);
     }
     return playerMove;
 
 }
 
-void runConnectFour(char board[][COLS], int rows, int cols, int player1Type, int player2Type){
-    int IndexChoiseArray[COLS];
+int predictReply(const Position *pos, int player, const SearchContext *ctx){
+    //the computer's last search usually stored its expected reply for this very position,
+    //otherwise the rules guess what the human plays
+    int mirrored;
+    TranspositionEntry entry;
+    if (ttProbe(&ctx->tt, positionCanonicalKey(pos, &mirrored), &entry)){
+        int move = mirrored ? pos->cols - 1 - entry.move : entry.move;
+        if (positionCanPlay(pos, move))
+            return move;
+    }
+    return generatePositionMove(pos, player, ctx->connectN, ctx->order);
+}
+
+void *ponderWorker(void *arg){
+    //chooseComputerMove for the predicted position, without its time and node budgets:
+    //it runs until the answer is final or the human has moved
+    Ponder *ponder = arg;
+    SearchContext *ctx = &ponder->ctx;
+    if (ctx->options.aiMode == AI_MCTS)
+        ponder->result = mctsBestMove(&ponder->pos, ponder->player, ctx);
+    else if (ctx->options.aiMode == AI_MAX)
+        ponder->result = solveBestMove(&ponder->pos, ponder->player, 0, ctx);
+    else
+        ponder->result = searchBestMove(&ponder->pos, ponder->player, ctx);
+    ponder->complete = ctx->options.aiMode != AI_MCTS && !ctx->stopped && ponder->result.move != -1;
+    countersFlush();
+    return NULL;
+}
+
+int startPonder(Ponder *ponder, const Position *pos, int human, const SearchContext *ctx){
+    //starts searching the position after the human's predicted reply with the computer's
+    //context ctx, returns 0 when there is nothing worth searching
+    if (!ctx->options.ponder || ctx->options.aiMode == AI_RULE)
+        return 0;
+    ponder->reply = predictReply(pos, human, ctx);
+    if (ponder->reply == -1 || isWinningMove(pos, human, ponder->reply, ctx->connectN))
+        return 0;
+    ponder->pos = *pos;
+    positionPlay(&ponder->pos, human, ponder->reply);
+    if (positionIsFull(&ponder->pos))
+        return 0;
+    //a book move is instant anyway; the solver of --ai=max is asked before the book
+    int score;
+    if (ctx->options.book != NULL && ctx->options.aiMode != AI_MAX && bookProbe(ctx->options.book, &ponder->pos, &score) != -1)
+        return 0;
+
+    ponder->ctx = *ctx;
+    ponder->ctx.options.timeLimitMs = 0;
+    ponder->ctx.options.nodeLimit = 0;
+    ponder->ctx.stopSignal = &ponder->stop;
+    ponder->player = 1 - human;
+    if (ctx->options.aiMode == AI_MCTS){
+        //the tree search grows its tree for every reply at once, the next move reuses it
+        ponder->pos = *pos;
+        ponder->player = human;
+    }
+    ponder->complete = 0;
+    atomic_init(&ponder->stop, 0);
+    return pthread_create(&ponder->thread, NULL, ponderWorker, ponder) == 0;
+}
+
+void stopPonder(Ponder *ponder, int reply, SearchContext *ctx){
+    //cancels the search once the human has played reply. the table it filled stays with
+    //ctx either way; a finished search for the right position also hands over its move.
+    atomic_store(&ponder->stop, 1);
+    pthread_join(ponder->thread, NULL);
+    if (reply != ponder->reply){
+        threadCounters.ponderMisses++;
+        return;
+    }
+    threadCounters.ponderHits++;
+    if (ponder->complete)
+        ctx->readyMove = ponder->result.move;
+}
+
+void commitMove(Position *pos, char board[][MAX_COLS], int player, int col){
+    //play on the bitboard and mirror the single changed cell into the char board
+    positionPlay(pos, player, col);
+    board[pos->rows - pos->heights[col]][col] = player == 0 ? TOKEN_P1 : TOKEN_P2;
+}
+
+void runConnectFour(char board[][MAX_COLS], int rows, int cols, int player1Type, int player2Type){
+    EngineOptions options;
+    defaultEngineOptions(&options);
+    runConnectFourWithOptions(board, rows, cols, CONNECT_N, player1Type, player2Type, &options);
+}
+
+void runConnectFourWithOptions(char board[][MAX_COLS], int rows, int cols, int connectN, int player1Type, int player2Type, const EngineOptions *options){
+    SearchContext playerContexts[2];
     int player1Won = 0, player2Won = 0;
+    Position pos;
+    long long moveNanos[MAX_CELLS]; //time of every computer move for --stats, -1 for a human move
+    long long moveStart;
+    GameOutput out;        //everything a move shows goes out with one write
 
-    //initialize preIndexChoiseArray
-    setIndexMap(IndexChoiseArray, cols);
+    //every player keeps its own search state, the move order comes from setIndexMap
+    searchContextInit(&playerContexts[0], options, cols, connectN);
+    searchContextInit(&playerContexts[1], options, cols, connectN);
+    positionLoad(&pos, board, rows, cols, connectN);
+    for (int i = 0; i < MAX_CELLS; i++)
+        moveNanos[i] = -1;
+    outputInit(&out, options->renderMode, STDOUT_FILENO);
+    renderMove(&out, board, rows, cols, -1);
+    outputFlush(&out);
     do {
 
-        //player 1
-        int movePlayer1 = playPlayerQueary(board, rows, cols, IndexChoiseArray, 1, player1Type);
-        insertToken(board, rows, cols, TOKEN_P1, movePlayer1);
-        printBoard(board, rows, cols);
-        if (checkIfNumSequenceForPlayer(TOKEN_P1, board, rows, cols, CONNECT_N)){
+        //player 1, the computer opponent searching ahead meanwhile
+        Ponder ponder;
+        int pondering = player1Type == HUMAN && player2Type == COMPUTER && startPonder(&ponder, &pos, 0, &playerContexts[1]);
+        moveStart = monotonicNanos();
+        int movePlayer1 = playPositionQueary(&pos, board, &playerContexts[0], 1, player1Type, &out);
+        if (pondering)
+            stopPonder(&ponder, movePlayer1, &playerContexts[1]);
+        moveNanos[pos.moveCount] = player1Type == COMPUTER ? monotonicNanos() - moveStart : -1;
+        commitMove(&pos, board, 0, movePlayer1);
+        renderMove(&out, board, rows, cols, movePlayer1);
+        outputFlush(&out);
+        if (positionMoveMakesSequence(&pos, 0, movePlayer1, connectN)){
             player1Won = 1;
             break;
         }
-        if (isBoardFull(board, rows, cols)){
+        if (positionIsFull(&pos)){
             break;
         }
 
         //player 2
-        int movePlayer2 = playPlayerQueary(board, rows, cols, IndexChoiseArray, 2, player2Type);
+        pondering = player2Type == HUMAN && player1Type == COMPUTER && startPonder(&ponder, &pos, 1, &playerContexts[0]);
+        moveStart = monotonicNanos();
+        int movePlayer2 = playPositionQueary(&pos, board, &playerContexts[1], 2, player2Type, &out);
+        if (pondering)
+            stopPonder(&ponder, movePlayer2, &playerContexts[0]);
+        moveNanos[pos.moveCount] = player2Type == COMPUTER ? monotonicNanos() - moveStart : -1;
         //insert move of player 2
-        insertToken(board, rows, cols, TOKEN_P2, movePlayer2);
+        commitMove(&pos, board, 1, movePlayer2);
         //cehck if player 2 won
-        printBoard(board, rows, cols);
-        if (checkIfNumSequenceForPlayer(TOKEN_P2, board, rows, cols, CONNECT_N)){
+        renderMove(&out, board, rows, cols, movePlayer2);
+        outputFlush(&out);
+        if (positionMoveMakesSequence(&pos, 1, movePlayer2, connectN)){
             player2Won = 1;
             break;
         }
     } 
-    while (!isBoardFull(board, rows, cols));
+    while (!positionIsFull(&pos));
     //if draw no one won;
     if (player1Won){
-        printf("Player 1 (%c) wins!", TOKEN_P1);
+        outputPrintf(&out, "Player 1 (%c) wins!", TOKEN_P1);
     }
     else if (player2Won)
     {
-        printf("Player 2 (%c) wins!", TOKEN_P2);
+        outputPrintf(&out, "Player 2 (%c) wins!", TOKEN_P2);
     }
     else{
-        printf("Board full and no winner. It's a tie!");
+        outputPrintf(&out, "Board full and no winner. It's a tie!");
+    }
+    if (options->showStats)
+        outputPrintf(&out, "\n");
+    outputFlush(&out);
+    if (options->showStats){
+        EngineCounters counters;
+        countersTotal(&counters);
+        printCounters(&counters, moveNanos, pos.moveCount);
+    }
+    searchContextFree(&playerContexts[0]);
+    searchContextFree(&playerContexts[1]);
+}
+
+void ex3DefaultConfig(Ex3Config *config){
+    EngineOptions options;
+    defaultEngineOptions(&options);
+    config->rows = ROWS;
+    config->cols = COLS;
+    config->connectN = CONNECT_N;
+    config->aiMode = options.aiMode;
+    config->maxDepth = options.maxDepth;
+    config->timeLimitMs = options.timeLimitMs;
+    config->nodeLimit = options.nodeLimit;
+    config->ttSizeMb = options.ttSizeMb;
+    config->evaluation = options.evaluation;
+    config->write = NULL;
+    config->user = NULL;
+}
+
+Ex3Engine *ex3EngineCreate(const Ex3Config *config){
+    //the only allocations of an engine: itself and its table or tree
+    if (!isValidBoardSize(config->rows, config->cols, config->connectN)
+        || config->aiMode < AI_RULE || config->aiMode > AI_MCTS
+        || (config->evaluation != EVAL_CENTER && config->evaluation != EVAL_THREATS)
+        || config->maxDepth <= 0 || config->timeLimitMs < 0 || config->nodeLimit < 0 || config->ttSizeMb < 0)
+        return NULL;
+    Ex3Engine *engine = malloc(sizeof(Ex3Engine));
+    if (engine == NULL)
+        return NULL;
+
+    EngineOptions options;
+    defaultEngineOptions(&options);
+    options.aiMode = config->aiMode;
+    options.maxDepth = config->maxDepth;
+    options.timeLimitMs = config->timeLimitMs;
+    options.nodeLimit = config->nodeLimit;
+    options.ttSizeMb = config->ttSizeMb;
+    options.evaluation = config->evaluation;
+    options.searchThreads = 1;  //helper threads would be created on every move
+    options.showStats = 1;      //computer moves are timed for ex3EngineStats
+    searchContextInit(&engine->ctx, &options, config->cols, config->connectN);
+    int noMemory = options.aiMode == AI_MCTS ? engine->ctx.mcts == NULL : options.aiMode != AI_RULE && engine->ctx.tt.buckets == NULL;
+    if (noMemory && options.ttSizeMb > 0){
+        free(engine);
+        return NULL;
     }
-}
\ No newline at end of file
+    memset(&engine->counters, 0, sizeof(engine->counters));
+    engine->write = config->write;
+    engine->user = config->user;
+    positionInit(&engine->pos, config->rows, config->cols, config->connectN);
+    ex3EngineReset(engine);
+    return engine;
+}
+
+void ex3EngineDestroy(Ex3Engine *engine){
+    if (engine == NULL)
+        return;
+    searchContextFree(&engine->ctx);
+    free(engine);
+}
+
+void ex3EngineReset(Ex3Engine *engine){
+    positionInit(&engine->pos, engine->pos.rows, engine->pos.cols, engine->pos.connectN);
+    initBoard(engine->board, engine->pos.rows, engine->pos.cols);
+    engine->status = EX3_PLAYING;
+    engine->ctx.readyMove = -1;
+}
+
+int ex3EnginePlay(Ex3Engine *engine, int col){
+    Position *pos = &engine->pos;
+    if (engine->status != EX3_PLAYING || col < 0 || col >= pos->cols || !positionCanPlay(pos, col))
+        return EX3_ILLEGAL;
+
+    int player = pos->moveCount & 1;
+    engine->moves[pos->moveCount] = (int8_t)col;
+    commitMove(pos, engine->board, player, col);
+    if (positionMoveMakesSequence(pos, player, col, pos->connectN))
+        engine->status = player == 0 ? EX3_WIN_P1 : EX3_WIN_P2;
+    else if (positionIsFull(pos))
+        engine->status = EX3_DRAW;
+    return engine->status;
+}
+
+int ex3EngineUndo(Ex3Engine *engine){
+    Position *pos = &engine->pos;
+    if (pos->moveCount == 0)
+        return 0;
+    int col = engine->moves[pos->moveCount - 1];
+    positionUndo(pos, col);
+    engine->board[pos->rows - 1 - pos->heights[col]][col] = EMPTY;
+    engine->status = EX3_PLAYING;
+    return 1;
+}
+
+int ex3EngineBestMove(Ex3Engine *engine){
+    if (engine->status != EX3_PLAYING)
+        return -1;
+    //the hot path counters belong to the thread, so the engine's own stand in for the move
+    EngineCounters saved = threadCounters;
+    threadCounters = engine->counters;
+    int move = computerPlayerMove(&engine->pos, engine->pos.moveCount & 1, &engine->ctx);
+    engine->counters = threadCounters;
+    threadCounters = saved;
+    return move;
+}
+
+int ex3EngineStatus(const Ex3Engine *engine){
+    return engine->status;
+}
+
+int ex3EngineMoveCount(const Ex3Engine *engine){
+    return engine->pos.moveCount;
+}
+
+int ex3EngineToMove(const Ex3Engine *engine){
+    return (engine->pos.moveCount & 1) + 1;
+}
+
+int ex3EngineCell(const Ex3Engine *engine, int row, int col){
+    if (!isInBounds(row, col, engine->pos.rows, engine->pos.cols))
+        return 0;
+    char token = engine->board[row][col];
+    return token == TOKEN_P1 ? 1 : (token == TOKEN_P2 ? 2 : 0);
+}
+
+void ex3EngineStats(const Ex3Engine *engine, Ex3Stats *stats){
+    stats->computerMoves = engine->counters.computerMoves;
+    stats->nodes = engine->counters.nodes;
+    stats->ttHits = engine->counters.ttHits;
+    stats->ttMisses = engine->counters.ttMisses;
+    stats->cutoffs = engine->counters.cutoffs;
+    stats->moveNanos = engine->counters.moveNanos;
+    stats->maxMoveNanos = engine->counters.maxMoveNanos;
+}
+
+void ex3EngineRender(const Ex3Engine *engine){
+    if (engine->write != NULL)
+        renderBoard((char (*)[MAX_COLS])engine->board, engine->pos.rows, engine->pos.cols, engine->write, engine->user);
+}
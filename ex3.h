@@ -0,0 +1,96 @@
+#ifndef EX3_H
+#define EX3_H
+
+/* Connect Four engine as a library.
+   Build the object without the program's main with  cc -O2 -pthread -DEX3_LIBRARY -c ex3.c
+   (add -fvisibility=hidden to export nothing but the functions below from a shared library).
+
+   An engine holds one game: the board, the move order, the transposition table and its own
+   statistics. Engines share nothing, so any number of them can live in one process as long as
+   each is used by one thread at a time. Everything is allocated by ex3EngineCreate; playing,
+   undoing and choosing moves never allocate and never print. */
+
+#include <stddef.h>
+
+#define EX3_API __attribute__((visibility("default")))
+
+/* Computer player modes, as --ai=rule|search|max|mcts */
+#define EX3_AI_RULE 1
+#define EX3_AI_SEARCH 2
+#define EX3_AI_MAX 3
+#define EX3_AI_MCTS 4
+
+/* Search leaf evaluations, as --eval=center|threats */
+#define EX3_EVAL_CENTER 1
+#define EX3_EVAL_THREATS 2
+
+/* Game status, also returned by ex3EnginePlay */
+#define EX3_ILLEGAL -1  //the move was not played: bad column, full column or game over
+#define EX3_PLAYING 0
+#define EX3_WIN_P1 1
+#define EX3_WIN_P2 2
+#define EX3_DRAW 3
+
+typedef struct Ex3Engine Ex3Engine;
+
+/* Receives every piece of text an engine writes, in order; text is not zero terminated */
+typedef void (*Ex3Write)(void *user, const char *text, size_t length);
+
+typedef struct {
+    int rows;              //up to 16 x 16 as long as (rows + 1) * cols <= 128
+    int cols;
+    int connectN;
+    int aiMode;            //EX3_AI_*
+    int maxDepth;          //deepest search iteration
+    long long timeLimitMs; //per-move wall clock budget, 0 for none
+    long long nodeLimit;   //per-move node budget, 0 for none
+    long long ttSizeMb;    //transposition table (or EX3_AI_MCTS tree) size, 0 for none
+    int evaluation;        //EX3_EVAL_*
+    Ex3Write write;        //output of ex3EngineRender, NULL for none
+    void *user;            //passed to write
+} Ex3Config;
+
+typedef struct {
+    long long computerMoves;
+    long long nodes;       //search and solver nodes, tree search playouts
+    long long ttHits;
+    long long ttMisses;
+    long long cutoffs;
+    long long moveNanos;   //wall clock of all computer moves
+    long long maxMoveNanos;
+} Ex3Stats;
+
+/* The defaults of the program: 6 x 7, connect 4, rule player, the search options of --ai=search */
+EX3_API void ex3DefaultConfig(Ex3Config *config);
+
+/* Returns NULL if the configuration is invalid or the memory cannot be allocated */
+EX3_API Ex3Engine *ex3EngineCreate(const Ex3Config *config);
+EX3_API void ex3EngineDestroy(Ex3Engine *engine);
+
+/* Starts a new game on the same engine; the table and the statistics are kept */
+EX3_API void ex3EngineReset(Ex3Engine *engine);
+
+/* Drops a token of the side to move into col (0 based) and returns the new status */
+EX3_API int ex3EnginePlay(Ex3Engine *engine, int col);
+
+/* Takes back the last move, returns 0 on the empty board */
+EX3_API int ex3EngineUndo(Ex3Engine *engine);
+
+/* The computer's column for the side to move, -1 once the game is over; nothing is played */
+EX3_API int ex3EngineBestMove(Ex3Engine *engine);
+
+EX3_API int ex3EngineStatus(const Ex3Engine *engine);
+EX3_API int ex3EngineMoveCount(const Ex3Engine *engine);
+
+/* 1 or 2 for the side to move */
+EX3_API int ex3EngineToMove(const Ex3Engine *engine);
+
+/* 0 for an empty cell, otherwise the player number; row 0 is the top row as printed */
+EX3_API int ex3EngineCell(const Ex3Engine *engine, int row, int col);
+
+EX3_API void ex3EngineStats(const Ex3Engine *engine, Ex3Stats *stats);
+
+/* Writes the board as the program prints it through config.write */
+EX3_API void ex3EngineRender(const Ex3Engine *engine);
+
+#endif